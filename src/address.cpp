@@ -0,0 +1,178 @@
+#include "editor.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+
+// Ranges are one address, two separated by a comma, or % for all lines.  With
+// a semicolon instead of the comma, the second address is taken from the
+// first rather than from the cursor.  A missing address stands for the cursor
+// line.
+bool Editor::parseRange(std::string_view& text, std::optional<LineRange>& range)
+{
+	range.reset();
+	if (text.starts_with('%'))
+	{
+		text.remove_prefix(1);
+		range = LineRange{.first=0, .last=buffer.numLines() - 1};
+		return true;
+	}
+
+	auto first = std::optional<int>{};
+	if (not parseAddress(text, cursor.line, first))
+	{
+		return false;
+	}
+	if (not text.starts_with(',') && not text.starts_with(';'))
+	{
+		if (first.has_value())
+		{
+			range = LineRange{.first=*first, .last=*first};
+		}
+	}
+	else
+	{
+		auto current = text.front() == ';' ? first.value_or(cursor.line) : cursor.line;
+		text.remove_prefix(1);
+		auto second = std::optional<int>{};
+		if (not parseAddress(text, current, second))
+		{
+			return false;
+		}
+		range = LineRange{.first=first.value_or(cursor.line), .last=second.value_or(current)};
+	}
+
+	if (range.has_value() && range->first > range->last)
+	{
+		displayMessage("ERR: Backwards range");
+		return false;
+	}
+	if (range.has_value() && (range->first < -1 || range->last >= std::max(1, buffer.numLines())))
+	{
+		displayMessage("ERR: Invalid range");
+		return false;
+	}
+	return true;
+}
+
+// An address is a line number, . for the current line, $ for the last line, 'x
+// for the line of mark x, or /pattern/ or ?pattern? for the next line down or
+// up that matches, followed by any number of +N and -N offsets; an offset
+// alone counts from the current line.  Addresses count lines from 1, so 0
+// comes out as line -1.
+bool Editor::parseAddress(std::string_view& text, int current, std::optional<int>& line)
+{
+	line.reset();
+	if (text.empty())
+	{
+		return true;
+	}
+
+	if (std::isdigit(static_cast<unsigned char>(text.front())))
+	{
+		auto number = 0;
+		auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), number);
+		if (error != std::errc{})
+		{
+			displayMessage("ERR: Invalid address");
+			return false;
+		}
+		text.remove_prefix(static_cast<std::size_t>(end - text.data()));
+		line = number - 1;
+	}
+	else if (text.front() == '.')
+	{
+		text.remove_prefix(1);
+		line = current;
+	}
+	else if (text.front() == '$')
+	{
+		text.remove_prefix(1);
+		line = buffer.numLines() - 1;
+	}
+	else if (text.front() == '\'')
+	{
+		if (text.size() < 2 || text[1] < 'a' || text[1] > 'z')
+		{
+			displayMessage("ERR: Invalid address");
+			return false;
+		}
+		line = markIndex.line(text[1]);
+		text.remove_prefix(2);
+		if (not line.has_value())
+		{
+			displayMessage("ERR: Mark not set");
+			return false;
+		}
+	}
+	else if (text.front() == '/' || text.front() == '?')
+	{
+		auto backward = text.front() == '?';
+		auto end = text.find(text.front(), 1);
+		auto patternText = std::string{text.substr(1, end == std::string_view::npos ? end : end - 1)};
+		text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+		if (patternText.empty())
+		{
+			patternText = lastSearch;
+		}
+		if (patternText.empty())
+		{
+			displayMessage("ERR: No previous search pattern");
+			return false;
+		}
+
+		auto pattern = Pattern(patternText);
+		if (not pattern.isValid())
+		{
+			displayMessage("ERR: " + pattern.error());
+			return false;
+		}
+		lastSearch = patternText;
+		line = findLine(pattern, current, backward);
+		if (not line.has_value())
+		{
+			displayMessage("ERR: Pattern not found: " + patternText);
+			return false;
+		}
+	}
+
+	while (text.starts_with('+') || text.starts_with('-'))
+	{
+		auto sign = text.front() == '+' ? 1 : -1;
+		text.remove_prefix(1);
+		auto offset = 1;
+		if (not text.empty() && std::isdigit(static_cast<unsigned char>(text.front())))
+		{
+			auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), offset);
+			if (error != std::errc{})
+			{
+				displayMessage("ERR: Invalid address");
+				return false;
+			}
+			text.remove_prefix(static_cast<std::size_t>(end - text.data()));
+		}
+		if (offset > buffer.numLines())
+		{
+			displayMessage("ERR: Invalid range");
+			return false;
+		}
+		line = line.value_or(current) + sign * offset;
+	}
+	return true;
+}
+
+// Searches every line once, starting next to `from` and wrapping around the
+// end of the buffer.
+std::optional<int> Editor::findLine(Pattern const& pattern, int from, bool backward) const
+{
+	auto lineCount = buffer.numLines();
+	for (auto i = 1; i <= lineCount; i++)
+	{
+		auto line = ((backward ? from - i : from + i) % lineCount + lineCount) % lineCount;
+		if (pattern.matches(buffer.getLine(line)))
+		{
+			return line;
+		}
+	}
+	return std::nullopt;
+}
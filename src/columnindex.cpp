@@ -0,0 +1,146 @@
+#include "editor.h"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+Editor::ColumnIndex::ColumnIndex(Buffer& b)
+	: buffer{b}
+{
+	buffer.attach(this);
+}
+
+Editor::ColumnIndex::~ColumnIndex()
+{
+	buffer.detach(this);
+}
+
+Utf8Char charAtByte(Editor::Buffer::LineText text, std::size_t i, bool isAscii)
+{
+	if (isAscii)
+	{
+		return {.codePoint=static_cast<unsigned char>(text[i]), .length=1};
+	}
+	return decodeUtf8(text, i);
+}
+
+int Editor::ColumnIndex::column(int line, int byte) const
+{
+	assert(byte >= 0);
+	auto& entry = checkpoints(line);
+	auto checkpoint = std::upper_bound(entry.points.begin(), entry.points.end(), byte,
+		[](int b, Position const& point) { return b < point.byte; }) - 1;
+
+	auto text = buffer.getLineText(line);
+	auto end = std::min(static_cast<std::size_t>(byte), text.length());
+	auto from = static_cast<std::size_t>(checkpoint - entry.points.begin());
+	return walk(entry, text, from, [end](std::size_t i, Utf8Char c, int) { return i + c.length <= end; }).column;
+}
+
+Editor::ColumnIndex::Position Editor::ColumnIndex::byteAt(int line, int column) const
+{
+	assert(column >= 0);
+	auto& entry = checkpoints(line);
+	auto checkpoint = std::upper_bound(entry.points.begin(), entry.points.end(), column,
+		[](int c, Position const& point) { return c < point.column; }) - 1;
+
+	auto text = buffer.getLineText(line);
+	auto from = static_cast<std::size_t>(checkpoint - entry.points.begin());
+	return walk(entry, text, from, [column](std::size_t, Utf8Char, int next) { return next <= column; });
+}
+
+int Editor::ColumnIndex::width(int line) const
+{
+	return column(line, static_cast<int>(buffer.getLineText(line).length()));
+}
+
+bool Editor::ColumnIndex::isAscii(int line) const
+{
+	return checkpoints(line).isAscii;
+}
+
+void Editor::ColumnIndex::linesChanged(int line, int removed, int inserted)
+{
+	if (removed == inserted)
+	{
+		for (auto i = line; i < line + removed; i++)
+		{
+			cache.erase(i);
+		}
+	}
+	else
+	{
+		std::erase_if(cache, [line](auto const& entry) { return entry.first >= line; });
+	}
+}
+
+void Editor::ColumnIndex::linesDeleted(int line, std::span<std::uint8_t const>)
+{
+	std::erase_if(cache, [line](auto const& entry) { return entry.first >= line; });
+}
+
+// What comes before the edit measures as it did, except that a character the
+// edit lands in or just after may now take in more or fewer bytes, so the
+// checkpoints within the last few bytes before it go too.
+void Editor::ColumnIndex::lineEdited(int line, int byte, int, int inserted)
+{
+	auto it = cache.find(line);
+	if (it == cache.end())
+	{
+		return;
+	}
+	auto& [isAscii, points] = it->second;
+	auto stillRight = std::partition_point(points.begin() + 1, points.end(),
+		[byte](Position const& point) { return point.byte + 3 < byte; });
+	points.erase(stillRight, points.end());
+	auto text = buffer.getLineText(line);
+	for (auto i = static_cast<std::size_t>(byte); isAscii && i < static_cast<std::size_t>(byte + inserted); i++)
+	{
+		isAscii = static_cast<unsigned char>(text[i]) < 0200;
+	}
+}
+
+// Checkpoint k is the first character starting at or after byte
+// k * checkpointInterval; those not yet placed are placed by walk.
+Editor::ColumnIndex::Checkpoints& Editor::ColumnIndex::checkpoints(int line) const
+{
+	if (auto it = cache.find(line); it != cache.end())
+	{
+		return it->second;
+	}
+	if (cache.size() >= maxCachedLines)
+	{
+		cache.clear();
+	}
+
+	auto text = buffer.getLineText(line);
+	auto entry = Checkpoints{.isAscii=::isAscii(text.head) && ::isAscii(text.tail), .points={{.byte=0, .column=0}}};
+	return cache.emplace(line, std::move(entry)).first->second;
+}
+
+template<typename Predicate>
+Editor::ColumnIndex::Position Editor::ColumnIndex::walk(
+	Checkpoints& entry, Buffer::LineText text, std::size_t from, Predicate goesOn)
+{
+	auto& points = entry.points;
+	auto position = points[from];
+	auto isLast = from + 1 == points.size();
+	auto nextCheckpoint = points.size() * checkpointInterval;
+	for (auto i = static_cast<std::size_t>(position.byte); i < text.length();)
+	{
+		if (isLast && i >= nextCheckpoint)
+		{
+			points.push_back(position);
+			nextCheckpoint += checkpointInterval;
+		}
+		auto c = charAtByte(text, i, entry.isAscii);
+		auto next = visibleUtf8CharLengthAccumulate(position.column, c);
+		if (not goesOn(i, c, next))
+		{
+			break;
+		}
+		i += c.length;
+		position = {.byte=static_cast<int>(i), .column=next};
+	}
+	return position;
+}
@@ -0,0 +1,381 @@
+#include "compression.h"
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string_view>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef VED_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+using Sink = std::function<void(std::string_view)>;
+
+Compression detectCompression(std::filesystem::path const& path)
+{
+	auto magic = std::array<unsigned char, 4>{};
+	auto file = std::ifstream(path, std::ios::binary);
+	file.read(reinterpret_cast<char*>(magic.data()), magic.size());
+	if (file.gcount() >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+	{
+		return Compression::Gzip;
+	}
+	if (file.gcount() == 4 && magic == std::array<unsigned char, 4>{0x28, 0xb5, 0x2f, 0xfd})
+	{
+		return Compression::Zstd;
+	}
+	return Compression::None;
+}
+
+Compression compressionFor(std::filesystem::path const& path)
+{
+	if (path.extension() == ".gz")
+	{
+		return Compression::Gzip;
+	}
+	if (path.extension() == ".zst")
+	{
+		return Compression::Zstd;
+	}
+	return detectCompression(path);
+}
+
+bool isSupported(Compression compression)
+{
+#ifdef VED_HAVE_ZSTD
+	return true;
+#else
+	return compression != Compression::Zstd;
+#endif
+}
+
+// Gzip files may hold several members one after the other, as left by
+// appending to a compressed log; they all belong to the text.
+bool inflateGzip(std::istream& input, std::stop_token const& stopToken, Sink const& sink)
+{
+	auto stream = z_stream{};
+	if (inflateInit2(&stream, 15 + 32) != Z_OK)  // 32: expect a gzip header
+	{
+		return false;
+	}
+
+	auto in = std::string(Decompressor::blockSize, '\0');
+	auto out = std::string(Decompressor::blockSize, '\0');
+	auto result = Z_OK;
+	while (not stopToken.stop_requested())
+	{
+		if (stream.avail_in == 0)
+		{
+			input.read(in.data(), static_cast<std::streamsize>(in.size()));
+			stream.next_in = reinterpret_cast<Bytef*>(in.data());
+			stream.avail_in = static_cast<uInt>(input.gcount());
+			if (stream.avail_in == 0)
+			{
+				break;
+			}
+		}
+		stream.next_out = reinterpret_cast<Bytef*>(out.data());
+		stream.avail_out = static_cast<uInt>(out.size());
+		result = inflate(&stream, Z_NO_FLUSH);
+		if (result != Z_OK && result != Z_STREAM_END)
+		{
+			break;
+		}
+		sink({out.data(), out.size() - stream.avail_out});
+		if (result == Z_STREAM_END)
+		{
+			inflateReset(&stream);
+		}
+	}
+	inflateEnd(&stream);
+	return result == Z_STREAM_END;
+}
+
+#ifdef VED_HAVE_ZSTD
+bool decompressZstd(std::istream& input, std::stop_token const& stopToken, Sink const& sink)
+{
+	auto context = ZSTD_createDStream();
+	if (context == nullptr)
+	{
+		return false;
+	}
+
+	auto in = std::string(Decompressor::blockSize, '\0');
+	auto out = std::string(ZSTD_DStreamOutSize(), '\0');
+	auto remaining = std::size_t{1};  // 0 once a frame has been completed
+	auto failed = false;
+	while (not stopToken.stop_requested() && not failed)
+	{
+		input.read(in.data(), static_cast<std::streamsize>(in.size()));
+		auto inBuffer = ZSTD_inBuffer{.src=in.data(), .size=static_cast<std::size_t>(input.gcount()), .pos=0};
+		if (inBuffer.size == 0)
+		{
+			break;
+		}
+		while (inBuffer.pos < inBuffer.size)
+		{
+			auto outBuffer = ZSTD_outBuffer{.dst=out.data(), .size=out.size(), .pos=0};
+			remaining = ZSTD_decompressStream(context, &outBuffer, &inBuffer);
+			if (ZSTD_isError(remaining))
+			{
+				failed = true;
+				break;
+			}
+			sink({out.data(), outBuffer.pos});
+		}
+	}
+	ZSTD_freeDStream(context);
+	return not failed && remaining == 0;
+}
+#endif
+
+Decompressor::Decompressor(std::filesystem::path const& path, Compression compression)
+	: eventFd{eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)}
+	, thread{[this, path, compression](std::stop_token stopToken) { run(stopToken, path, compression); }}
+{
+}
+
+Decompressor::~Decompressor()
+{
+	thread.request_stop();
+	thread.join();
+	if (eventFd >= 0)
+	{
+		::close(eventFd);
+	}
+}
+
+int Decompressor::fd() const
+{
+	return eventFd;
+}
+
+Decompressor::Batch Decompressor::take()
+{
+	auto count = std::uint64_t{0};
+	[[maybe_unused]] auto n = ::read(eventFd, &count, sizeof count);
+
+	auto lock = std::lock_guard{mutex};
+	auto batch = Batch{.lines=std::move(ready), .status=status};
+	ready.clear();
+	return batch;
+}
+
+Decompressor::Batch Decompressor::takeAll()
+{
+	{
+		auto lock = std::unique_lock{mutex};
+		finished.wait(lock, [this] { return status != Status::Running; });
+	}
+	return take();
+}
+
+void Decompressor::run(std::stop_token stopToken, std::filesystem::path path, Compression compression)
+{
+	auto lines = std::vector<std::string>{};
+	auto partialLine = std::string{};
+	auto split = [&](std::string_view text)
+	{
+		for (auto newline = text.find('\n'); newline != std::string_view::npos; newline = text.find('\n'))
+		{
+			partialLine += text.substr(0, newline);
+			lines.push_back(std::move(partialLine));
+			partialLine.clear();
+			text.remove_prefix(newline + 1);
+		}
+		partialLine += text;
+		hand(lines, Status::Running);
+	};
+
+	auto input = std::ifstream(path, std::ios::binary);
+	auto complete = false;
+	if (input && compression == Compression::Gzip)
+	{
+		complete = inflateGzip(input, stopToken, split);
+	}
+#ifdef VED_HAVE_ZSTD
+	else if (input && compression == Compression::Zstd)
+	{
+		complete = decompressZstd(input, stopToken, split);
+	}
+#endif
+	if (not partialLine.empty())
+	{
+		lines.push_back(std::move(partialLine));
+	}
+	hand(lines, complete ? Status::Finished : Status::Failed);
+}
+
+void Decompressor::hand(std::vector<std::string>& lines, Status newStatus)
+{
+	if (lines.empty() && newStatus == Status::Running)
+	{
+		return;
+	}
+	{
+		auto lock = std::lock_guard{mutex};
+		if (ready.empty())
+		{
+			ready = std::move(lines);
+		}
+		else
+		{
+			ready.insert(ready.end(), std::make_move_iterator(lines.begin()), std::make_move_iterator(lines.end()));
+		}
+		status = newStatus;
+	}
+	lines.clear();
+	if (newStatus != Status::Running)
+	{
+		finished.notify_all();
+	}
+	auto one = std::uint64_t{1};
+	[[maybe_unused]] auto n = ::write(eventFd, &one, sizeof one);
+}
+
+bool writeCompressedBlock(int outputFd, std::string_view data)
+{
+	while (not data.empty())
+	{
+		auto n = ::write(outputFd, data.data(), data.size());
+		if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (n <= 0)
+		{
+			return false;
+		}
+		data.remove_prefix(static_cast<std::size_t>(n));
+	}
+	return true;
+}
+
+bool deflateGzip(int outputFd, std::function<bool(std::string&)> const& fill)
+{
+	auto stream = z_stream{};
+	if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)  // 16: gzip
+	{
+		return false;
+	}
+
+	auto text = std::string{};
+	auto out = std::string(Decompressor::blockSize, '\0');
+	auto more = true;
+	auto result = Z_OK;
+	while (result == Z_OK)
+	{
+		text.clear();
+		more = more && fill(text);
+		stream.next_in = reinterpret_cast<Bytef*>(text.data());
+		stream.avail_in = static_cast<uInt>(text.size());
+		do
+		{
+			stream.next_out = reinterpret_cast<Bytef*>(out.data());
+			stream.avail_out = static_cast<uInt>(out.size());
+			result = deflate(&stream, more ? Z_NO_FLUSH : Z_FINISH);
+			if (not writeCompressedBlock(outputFd, {out.data(), out.size() - stream.avail_out}))
+			{
+				result = Z_ERRNO;
+			}
+		} while (result == Z_OK && stream.avail_out == 0);
+		if (result == Z_BUF_ERROR)  // nothing to do for lack of input
+		{
+			result = Z_OK;
+		}
+	}
+	deflateEnd(&stream);
+	return result == Z_STREAM_END;
+}
+
+// Compressing a frame is spread over as many threads as there are cores, when
+// the library was built to allow it.
+#ifdef VED_HAVE_ZSTD
+bool compressZstd(int outputFd, std::function<bool(std::string&)> const& fill)
+{
+	auto context = ZSTD_createCCtx();
+	if (context == nullptr)
+	{
+		return false;
+	}
+	ZSTD_CCtx_setParameter(context, ZSTD_c_nbWorkers, static_cast<int>(std::thread::hardware_concurrency()));
+
+	auto text = std::string{};
+	auto out = std::string(ZSTD_CStreamOutSize(), '\0');
+	auto more = true;
+	auto ok = true;
+	for (auto remaining = std::size_t{1}; ok && remaining != 0; )
+	{
+		text.clear();
+		more = more && fill(text);
+		auto mode = more ? ZSTD_e_continue : ZSTD_e_end;
+		auto inBuffer = ZSTD_inBuffer{.src=text.data(), .size=text.size(), .pos=0};
+		do
+		{
+			auto outBuffer = ZSTD_outBuffer{.dst=out.data(), .size=out.size(), .pos=0};
+			remaining = ZSTD_compressStream2(context, &outBuffer, &inBuffer, mode);
+			ok = not ZSTD_isError(remaining) && writeCompressedBlock(outputFd, {out.data(), outBuffer.pos});
+		} while (ok && (mode == ZSTD_e_end ? remaining != 0 : inBuffer.pos < inBuffer.size));
+		if (more)
+		{
+			remaining = 1;
+		}
+	}
+	ZSTD_freeCCtx(context);
+	return ok;
+}
+#endif
+
+bool writeCompressed(
+	std::filesystem::path const& path, Compression compression, std::function<bool(std::string&)> const& fill)
+{
+	if (compression == Compression::None || not isSupported(compression))
+	{
+		return false;
+	}
+
+	auto tempPath = path.string() + ".XXXXXX";
+	auto outputFd = mkstemp(tempPath.data());
+	if (outputFd < 0)
+	{
+		return false;
+	}
+	if (struct stat target{}; ::stat(path.c_str(), &target) == 0)
+	{
+		fchmod(outputFd, target.st_mode & 07777);
+	}
+	else
+	{
+		auto mask = umask(0);
+		umask(mask);
+		fchmod(outputFd, 0666 & ~mask);
+	}
+
+	auto written = false;
+	if (compression == Compression::Gzip)
+	{
+		written = deflateGzip(outputFd, fill);
+	}
+#ifdef VED_HAVE_ZSTD
+	else
+	{
+		written = compressZstd(outputFd, fill);
+	}
+#endif
+	if (not written || fsync(outputFd) != 0 || std::rename(tempPath.c_str(), path.c_str()) != 0)
+	{
+		::close(outputFd);
+		::unlink(tempPath.c_str());
+		return false;
+	}
+	::close(outputFd);
+	return true;
+}
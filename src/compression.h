@@ -0,0 +1,74 @@
+#ifndef SRC_COMPRESSION_H_
+#define SRC_COMPRESSION_H_
+
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class Compression
+{
+	None, Gzip, Zstd
+};
+
+// What a file is compressed with, going by its first bytes.
+Compression detectCompression(std::filesystem::path const&);
+
+// What a file written to path should be compressed with: its extension says
+// so, or else the file already there was compressed.
+Compression compressionFor(std::filesystem::path const&);
+
+bool isSupported(Compression);
+
+// Decompresses a file on a thread of its own, handing over the complete lines
+// as they come out, so the first of them can be shown while the rest of the
+// file is still being decompressed.
+class Decompressor
+{
+public:
+	Decompressor(std::filesystem::path const&, Compression);
+	~Decompressor();
+	Decompressor(Decompressor const&) = delete;
+	Decompressor& operator=(Decompressor const&) = delete;
+
+	int fd() const;  // readable once there are lines to take
+
+	enum class Status
+	{
+		Running, Finished, Failed
+	};
+	struct Batch
+	{
+		std::vector<std::string> lines{};
+		Status status{Status::Running};
+	};
+	Batch take();
+	Batch takeAll();  // waits for the whole file
+
+	static constexpr auto blockSize = std::size_t{1} << 18;
+
+private:
+	void run(std::stop_token, std::filesystem::path, Compression);
+	void hand(std::vector<std::string>& lines, Status);
+
+	int eventFd{-1};
+
+	std::mutex mutex{};
+	std::condition_variable finished{};
+	std::vector<std::string> ready{};
+	Status status{Status::Running};
+
+	std::jthread thread{};
+};
+
+// Compresses text into a temporary file that then takes path's place.  fill
+// appends the next piece of the text to its argument and returns false along
+// with the last one.
+[[nodiscard]] bool writeCompressed(
+	std::filesystem::path const&, Compression, std::function<bool(std::string&)> const& fill);
+
+#endif // SRC_COMPRESSION_H_
@@ -1,27 +1,43 @@
 #include "editor.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cctype>
+#include <charconv>
 #include <fstream>
+#include <iterator>
+#include <mutex>
 #include <numeric>
+#include <span>
+#include <sstream>
 #include <string>
+#include <utility>
 
 #include <wordexp.h>
 
 #include "ncursespp/color.h"
 
 #include "ops.h"
+#include "terminal.h"
 
 void Editor::Buffer::erase(CursorPosition p, int count)
 {
 	assert(p.line >= 0);
-	auto lineIndex = static_cast<std::size_t>(p.line);
 	assert(p.col >= 0);
 	auto colIndex = static_cast<std::size_t>(p.col);
 	assert(count > 0);
 	auto sizeCount = static_cast<std::size_t>(count);
 
-	lines[lineIndex].erase(colIndex, sizeCount);
+	if (isBeingEdited(p.line))
+	{
+		editedLine->erase(colIndex, sizeCount);
+	}
+	else
+	{
+		lines.edit(p.line).erase(colIndex, sizeCount);
+	}
+	notifyEdit(p.line, p.col, count, 0);
 }
 
 void Editor::Buffer::insert(CursorPosition p, char ch, int count)
@@ -29,52 +45,59 @@ void Editor::Buffer::insert(CursorPosition p, char ch, int count)
 	if (isEmpty())
 	{
 		assert(p.line == 0 && p.col == 0);
-		lines.push_back("");
+		lines.splice(0, 0, {""});
+		notifyObservers(0, 0, 1);
 	}
 
 	assert(p.line >= 0);
-	auto lineIndex = static_cast<std::size_t>(p.line);
 	assert(p.col >= 0);
 	auto colIndex = static_cast<std::size_t>(p.col);
 	assert(count > 0);
 	auto sizeCount = static_cast<std::size_t>(count);
 
-	lines[lineIndex].insert(colIndex, sizeCount, ch);
+	if (isBeingEdited(p.line))
+	{
+		editedLine->insert(colIndex, ch, sizeCount);
+	}
+	else
+	{
+		lines.edit(p.line).insert(colIndex, sizeCount, ch);
+	}
+	notifyEdit(p.line, p.col, 0, count);
 }
 
 void Editor::Buffer::insertLine(int line)
 {
+	endLineEdit();
 	if (isEmpty())
 	{
 		assert(line == 0);
-		lines.push_back("");
+		lines.splice(0, 0, {""});
+		notifyObservers(0, 0, 1);
 	}
 
-	lines.insert(lines.begin() + line + 1, "");
+	lines.splice(line + 1, 0, {""});
+	notifyObservers(line + 1, 0, 1);
 }
 
 void Editor::Buffer::breakLine(CursorPosition p)
 {
+	endLineEdit();
 	if (isEmpty())
 	{
 		assert(p.line == 0 && p.col == 0);
-		lines.push_back("");
+		lines.splice(0, 0, {""});
+		notifyObservers(0, 0, 1);
 	}
 
 	assert(p.line >= 0);
-	auto lineIndex = static_cast<std::size_t>(p.line);
 	assert(p.col >= 0);
 	auto colIndex = static_cast<std::size_t>(p.col);
-	if (lines[lineIndex].length() == colIndex)
-	{
-		lines.emplace(lines.begin() + p.line + 1);
-	}
-	else
-	{
-		auto tail = lines[lineIndex].substr(colIndex);
-		lines[lineIndex] = lines[lineIndex].substr(0, colIndex);
-		lines.emplace(lines.begin() + p.line + 1, tail);
-	}
+	auto& line = lines.edit(p.line);
+	auto tail = line.substr(colIndex);
+	line.resize(colIndex);
+	lines.splice(p.line + 1, 0, {std::move(tail)});
+	notifyObservers(p.line, 1, 2);
 }
 
 void Editor::Buffer::joinLines(int line, int count)
@@ -84,22 +107,47 @@ void Editor::Buffer::joinLines(int line, int count)
 		return;
 	}
 
+	endLineEdit();
+
 	assert(line >= 0);
-	auto lineIndex = static_cast<std::size_t>(line);
 
-	lines[lineIndex] = std::accumulate(
-		lines.cbegin() + line,
-		lines.cbegin() + line + count,
-		std::string{}, [](auto const& acc, auto const& lhs) { return acc + lhs; }
-	);
-	lines.erase(lines.cbegin() + line + 1, lines.cbegin() + line + count);
+	auto joinedLength = std::size_t{0};
+	for (auto i = line; i < line + count; i++)
+	{
+		joinedLength += lines[i].length();
+	}
+	auto joined = std::string{};
+	joined.reserve(joinedLength);
+	for (auto i = line; i < line + count; i++)
+	{
+		joined += lines[i];
+	}
+	lines.splice(line, count, {std::move(joined)});
+	notifyObservers(line, count, 1);
 }
 
 void Editor::Buffer::yankTo(Register& r, int line, int count) const
 {
+	assert(not editedLine.has_value());
 	r.lines.clear();
 	count = std::min(count, numLines() - line);
-	r.lines.insert(r.lines.end(), lines.begin() + line, lines.begin() + line + count);
+	for (auto i = line; i < line + count; i++)
+	{
+		r.lines.push_back(lines[i]);
+	}
+}
+
+void Editor::Buffer::yankTo(Register& r, int line, LineStore::Marks const& marks) const
+{
+	assert(not editedLine.has_value());
+	r.lines.clear();
+	for (auto i = std::size_t{0}; i < marks.size(); i++)
+	{
+		if (marks[i] != 0)
+		{
+			r.lines.push_back(lines[line + static_cast<int>(i)]);
+		}
+	}
 }
 
 void Editor::Buffer::putFrom(Register const& r, int line)
@@ -107,9 +155,10 @@ void Editor::Buffer::putFrom(Register const& r, int line)
 	if (isEmpty())
 	{
 		assert(line == 0);
-		lines.push_back("");
+		lines.splice(0, 0, {""});
+		notifyObservers(0, 0, 1);
 	}
-	lines.insert(lines.begin() + line + 1, r.lines.cbegin(), r.lines.cend());
+	insertLines(line + 1, r.lines);
 }
 
 void Editor::Buffer::deleteLines(int line, int count)
@@ -119,12 +168,126 @@ void Editor::Buffer::deleteLines(int line, int count)
 		return;
 	}
 	count = std::min(count, numLines() - line);
-	lines.erase(lines.cbegin() + line, lines.cbegin() + line + count);
+	replaceLines(line, count, {});
+}
+
+void Editor::Buffer::deleteLines(int line, LineStore::Marks const& marks)
+{
+	auto first = std::find_if(marks.begin(), marks.end(), [](auto mark) { return mark != 0; });
+	if (first == marks.end())
+	{
+		return;
+	}
+	endLineEdit();
+	auto last = std::find_if(marks.rbegin(), marks.rend(), [](auto mark) { return mark != 0; }).base();
+
+	lines.erase(line, marks);
+	for (auto observer: observers)
+	{
+		observer->linesDeleted(line + static_cast<int>(first - marks.begin()), {first, last});
+	}
+}
+
+void Editor::Buffer::rearrangeLines(int line, int count, std::vector<int> const& order)
+{
+	endLineEdit();
+	lines.rearrange(line, count, order);
+	notifyObservers(line, count, static_cast<int>(order.size()));
+}
+
+bool Editor::Buffer::holdLines(int line, int count)
+{
+	endLineEdit();
+	return lines.hold(line, count);
+}
+
+void Editor::Buffer::insertLines(int line, std::vector<std::string> newLines)
+{
+	replaceLines(line, 0, std::move(newLines));
+}
+
+// Inserts text that may span several lines at p and returns the position just
+// past it.  The whole text goes in with a single splice.
+CursorPosition Editor::Buffer::insertText(CursorPosition p, std::string_view text)
+{
+	endLineEdit();
+	if (isEmpty())
+	{
+		assert(p.line == 0 && p.col == 0);
+		lines.splice(0, 0, {""});
+		notifyObservers(0, 0, 1);
+	}
+
+	assert(p.line >= 0);
+	assert(p.col >= 0);
+	auto colIndex = static_cast<std::size_t>(p.col);
+
+	auto& line = lines[p.line];
+	auto newLines = std::vector<std::string>{line.substr(0, colIndex)};
+	for (auto i = std::size_t{0}; i < text.length(); i++)
+	{
+		if (text[i] == '\r' || text[i] == '\n')
+		{
+			if (text[i] == '\r' && i + 1 < text.length() && text[i + 1] == '\n')
+			{
+				i++;
+			}
+			newLines.emplace_back();
+		}
+		else
+		{
+			newLines.back() += text[i];
+		}
+	}
+	auto end = CursorPosition{
+		.line=p.line + static_cast<int>(newLines.size()) - 1,
+		.col=static_cast<int>(newLines.back().length())
+	};
+	newLines.back() += line.substr(colIndex);
+
+	replaceLines(p.line, 1, std::move(newLines));
+	return end;
+}
+
+// Replaces lines [line, line + count) with newLines in a single splice.
+void Editor::Buffer::replaceLines(int line, int count, std::vector<std::string> newLines)
+{
+	endLineEdit();
+
+	assert(line >= 0 && count >= 0);
+	assert(line + count <= numLines());
+
+	auto inserted = static_cast<int>(newLines.size());
+	lines.splice(line, count, std::move(newLines));
+	notifyObservers(line, count, inserted);
+}
+
+// Observers hear of each run of consecutive lines changed once.
+void Editor::Buffer::changeLines(std::vector<std::pair<int, std::string>> changes)
+{
+	endLineEdit();
+
+	auto runStart = 0;
+	for (auto i = std::size_t{0}; i < changes.size(); i++)
+	{
+		auto& [line, text] = changes[i];
+		assert(line >= 0 && line < numLines());
+		assert(i == 0 || line > changes[i - 1].first);
+		lines.edit(line) = std::move(text);
+		if (i == 0 || line != changes[i - 1].first + 1)
+		{
+			runStart = line;
+		}
+		if (i + 1 == changes.size() || changes[i + 1].first != line + 1)
+		{
+			notifyObservers(runStart, line + 1 - runStart, line + 1 - runStart);
+		}
+	}
 }
 
 int Editor::Buffer::numLines() const
 {
-	return static_cast<int>(lines.size());
+	return lines.size();
 }
 
 bool Editor::Buffer::isEmpty() const
@@ -134,240 +297,1303 @@ bool Editor::Buffer::isEmpty() const
 
 void Editor::Buffer::clear()
 {
+	endLineEdit();
+	decompressor.reset();
+	auto removed = numLines();
 	lines.clear();
+	notifyObservers(0, removed, 0);
 }
 
 void Editor::Buffer::read(std::filesystem::path const& filePath)
 {
+	endLineEdit();
+	auto prevLines = numLines();
+
+	if (auto compression = detectCompression(filePath); compression != Compression::None)
+	{
+		decompressor.emplace(filePath, compression);
+		return;
+	}
+
+	if (isEmpty() && wouldMap(filePath))
+	{
+		lines.map(filePath, memoryLimit);
+		notifyObservers(0, 0, numLines());
+		return;
+	}
+
 	auto fileHandler = std::ifstream(filePath);
+	auto newLines = std::vector<std::string>{};
 	for (std::string lineBuffer; std::getline(fileHandler, lineBuffer); )
 	{
-		lines.push_back(lineBuffer);
+		newLines.push_back(std::move(lineBuffer));
 	}
 	fileHandler.close();
+	lines.splice(prevLines, 0, std::move(newLines));
+	notifyObservers(prevLines, 0, numLines() - prevLines);
+}
+
+void Editor::Buffer::setMemoryLimit(std::size_t limit)
+{
+	memoryLimit = limit;
+}
+
+bool Editor::Buffer::isMapped() const
+{
+	return lines.isMapped();
+}
+
+std::optional<FileDigest> Editor::Buffer::takeMappedDigest()
+{
+	return lines.takeDigest();
+}
+
+// In memory a file takes several times its size once split into lines.
+bool Editor::Buffer::wouldMap(std::filesystem::path const& filePath) const
+{
+	auto error = std::error_code{};
+	return std::filesystem::file_size(filePath, error) > memoryLimit / 4 && not error;
 }
 
 void Editor::Buffer::read(std::filesystem::path const& filePath, int line)
 {
+	if (isEmpty())
+	{
+		assert(line <= 0);
+		lines.splice(0, 0, {""});
+		notifyObservers(0, 0, 1);
+		line = 0;
+	}
+
+	if (auto compression = detectCompression(filePath); compression != Compression::None)
+	{
+		insertLines(line + 1, Decompressor(filePath, compression).takeAll().lines);
+		return;
+	}
+
 	auto fileHandler = std::ifstream(filePath);
-	auto it = lines.begin() + line + 1;
+	auto newLines = std::vector<std::string>{};
 	for (std::string lineBuffer; std::getline(fileHandler, lineBuffer); )
 	{
-		it = lines.insert(it, lineBuffer) + 1;
+		newLines.push_back(std::move(lineBuffer));
 	}
 	fileHandler.close();
+
+	insertLines(line + 1, std::move(newLines));
 }
 
-void Editor::Buffer::write(std::filesystem::path const& filePath) const
+bool Editor::Buffer::write(std::filesystem::path const& filePath)
 {
-	auto fileHandler = std::ofstream(filePath);
-	for (auto& line: lines)
+	if (compressionFor(filePath) == Compression::None)
 	{
-		fileHandler << line << "\n";
+		assert(not editedLine.has_value());
+		return lines.write(filePath);
 	}
-	fileHandler.close();
+	return write(filePath, 0, numLines());
 }
 
-int Editor::Buffer::lineLength(int idx) const
+// Lines [line, line + count) go straight from the line store to the file.
+bool Editor::Buffer::write(std::filesystem::path const& filePath, int line, int count)
 {
-	if (isEmpty())
+	assert(not editedLine.has_value());
+	assert(line >= 0 && count >= 0 && line + count <= numLines());
+	auto compression = compressionFor(filePath);
+	if (compression == Compression::None)
 	{
-		return 0;
+		return lines.write(filePath, line, count);
 	}
-	assert(idx >= 0);
-	auto index = static_cast<std::size_t>(idx);
-	return static_cast<int>(lines[index].length());
+
+	auto end = line + count;
+	return writeCompressed(filePath, compression, [this, &line, end](std::string& text)
+	{
+		for (; line < end && text.length() < Decompressor::blockSize; line++)
+		{
+			text += lines[line];
+			text += '\n';
+		}
+		return line < end;
+	});
 }
 
-std::string const& Editor::Buffer::getLine(int idx) const
+bool Editor::Buffer::write(std::filesystem::path const& filePath, int line, LineStore::Marks const& marks)
 {
-	assert(idx >= 0);
-	auto index = static_cast<std::size_t>(idx);
-	return lines[index];
+	assert(not editedLine.has_value());
+	auto compression = compressionFor(filePath);
+	if (compression == Compression::None)
+	{
+		return lines.write(filePath, line, marks);
+	}
+
+	auto i = std::size_t{0};
+	return writeCompressed(filePath, compression, [this, line, &marks, &i](std::string& text)
+	{
+		for (; i < marks.size() && text.length() < Decompressor::blockSize; i++)
+		{
+			if (marks[i] != 0)
+			{
+				text += lines[line + static_cast<int>(i)];
+				text += '\n';
+			}
+		}
+		return i < marks.size();
+	});
 }
 
-// *** //
+std::optional<std::vector<std::string>> Editor::Buffer::filter(
+	int line, int count, std::string const& command, std::string& error) const
+{
+	assert(not editedLine.has_value());
+	assert(line >= 0 && count >= 0 && line + count <= numLines());
+	auto end = line + count;
+	return runFilter(command, [this, &line, end](std::string& text)
+	{
+		for (; line < end && text.length() < Decompressor::blockSize; line++)
+		{
+			text += lines[line];
+			text += '\n';
+		}
+		return line < end;
+	}, error);
+}
 
-Editor::Editor()
-	: context{}
-	, editorWindow{{{4, 0}, {0, context.get_rect().s.h - 1}}}
-	, lineNumbers({{0, 0}, {4, context.get_rect().s.h - 1}})
-	, statusLine{{{0, context.get_rect().s.h - 1}, {}}}
+bool Editor::Buffer::isLoading() const
 {
-	context.raw(true);
-	editorWindow.setbackground(ncurses::Color::White, ncurses::Color::Black);
-	editorWindow.setcolor(ncurses::Color::White, ncurses::Color::Black);
-	lineNumbers.setbackground(ncurses::Color::Gray, ncurses::Color::Black);
-	lineNumbers.setcolor(ncurses::Color::Gray, ncurses::Color::Black);
-	context.refresh();
-	repaint();
+	return decompressor.has_value();
 }
 
-std::filesystem::path resolvePath(std::filesystem::path const& path)
+int Editor::Buffer::loadingFd() const
 {
-	wordexp_t p;
-	wordexp(path.c_str(), &p, 0);
-	auto resolvedPath = std::filesystem::path{p.we_wordv[p.we_offs]};
-	wordfree(&p);
-	return resolvedPath;
+	return decompressor.has_value() ? decompressor->fd() : -1;
 }
 
-void Editor::open(std::filesystem::path const& path, Force force)
+// The lines go straight to the end of the store, leaving a line being edited
+// in Insert mode where it is.
+Decompressor::Status Editor::Buffer::loadMore(bool wait)
 {
-	auto resolvedPath = resolvePath(path);
-	if (not std::filesystem::exists(resolvedPath))
+	assert(decompressor.has_value());
+	auto batch = wait ? decompressor->takeAll() : decompressor->take();
+	if (batch.status != Decompressor::Status::Running)
 	{
-		displayMessage("ERR: Could not open `" + path.string() + "': file does not exist");
-		return;
+		decompressor.reset();
 	}
-	if (not std::filesystem::is_regular_file(resolvedPath))
+	if (not batch.lines.empty())
 	{
-		displayMessage("ERR: Could not open `" + path.string() + "': not a regular file");
-		return;
+		auto prevLines = numLines();
+		lines.splice(prevLines, 0, std::move(batch.lines));
+		notifyObservers(prevLines, 0, numLines() - prevLines);
 	}
-	if (modified and force == Force::No)
+	return batch.status;
+}
+
+// Brings the buffer in line with a newer version of its file by reading only
+// the lines that differ.  A mapped file has only the chunks holding them
+// found again, unless its store refuses; then it is mapped again whole.
+void Editor::Buffer::reload(std::filesystem::path const& filePath, FileDigest::Difference const& difference)
+{
+	endLineEdit();
+	if (lines.isMapped())
 	{
-		displayMessage("ERR: No write since last change (add ! to override)");
+		if (lines.remap(filePath, difference))
+		{
+			notifyObservers(difference.line, difference.removed, difference.inserted);
+			return;
+		}
+		auto removed = numLines();
+		lines.map(filePath, memoryLimit);
+		lines.takeDigest();
+		notifyObservers(0, removed, numLines());
 		return;
 	}
 
-	file = resolvedPath;
-
-	buffer.clear();
-	buffer.read(file);
-	modified = false;
+	auto fileHandler = std::ifstream(filePath, std::ios::binary);
+	fileHandler.seekg(static_cast<std::streamoff>(difference.offset));
+	auto text = std::string(difference.length, '\0');
+	fileHandler.read(text.data(), static_cast<std::streamsize>(text.size()));
+	text.resize(static_cast<std::size_t>(fileHandler.gcount()));
 
-	cursor.line = std::min(cursor.line, buffer.numLines()-1);
-	auto cursorLineLength = buffer.lineLength(cursor.line);
-	cursor.col = std::min(cursor.col, std::max(0, cursorLineLength - 1));
-	
-	adjustViewport();
-	repaint();
+	auto newLines = std::vector<std::string>{};
+	auto textStream = std::istringstream(std::move(text));
+	for (std::string lineBuffer; std::getline(textStream, lineBuffer); )
+	{
+		newLines.push_back(std::move(lineBuffer));
+	}
+	replaceLines(difference.line, std::min(difference.removed, numLines() - difference.line), std::move(newLines));
 }
 
-void Editor::read(std::filesystem::path const& path)
+int Editor::Buffer::lineLength(int idx) const
 {
-	auto resolvedPath = resolvePath(path);
-	if (not std::filesystem::exists(resolvedPath))
+	if (isEmpty())
 	{
-		displayMessage("ERR: Could not open `" + path.string() + "': file does not exist");
-		return;
+		return 0;
 	}
-	if (not std::filesystem::is_regular_file(resolvedPath))
+	assert(idx >= 0);
+	if (isBeingEdited(idx))
 	{
-		displayMessage("ERR: Could not open `" + path.string() + "': not a regular file");
-		return;
+		return static_cast<int>(editedLine->length());
 	}
+	return static_cast<int>(lines[idx].length());
+}
 
-	auto prevLines = buffer.numLines();
-	buffer.read(resolvedPath, cursor.line);
-	auto newLines = buffer.numLines() - prevLines;
+std::string const& Editor::Buffer::getLine(int idx) const
+{
+	assert(idx >= 0);
+	assert(not isBeingEdited(idx));
+	return lines[idx];
+}
 
-	modified = true;
+void Editor::Buffer::scan(int line, int count, ThreadPool& pool, LineStore::Visitor const& visit) const
+{
+	assert(not editedLine.has_value());
+	lines.scan(line, count, pool, visit);
+}
 
-	repaint();
+Editor::Buffer::LineText Editor::Buffer::getLineText(int idx) const
+{
+	if (isBeingEdited(idx))
+	{
+		return {.head=editedLine->beforeGap(), .tail=editedLine->afterGap()};
+	}
+	return {.head=getLine(idx)};
+}
 
-	displayMessage("\"" + resolvedPath.string() + "\" " + std::to_string(newLines) + " lines read");
+void Editor::Buffer::beginLineEdit(int line)
+{
+	if (isBeingEdited(line) || line >= numLines())
+	{
+		return;
+	}
+	endLineEdit();
+
+	assert(line >= 0);
+	editedLine.emplace(std::move(lines.edit(line)));
+	editedLineIndex = line;
 }
 
-void Editor::write(std::filesystem::path const& path, Force force)
+void Editor::Buffer::endLineEdit()
 {
-	auto resolvedPath = resolvePath(path);
-	if (std::filesystem::exists(resolvedPath) && file != resolvedPath)
+	if (not editedLine.has_value())
 	{
-		if (force == Force::Yes)
-		{
-			if (not std::filesystem::is_regular_file(resolvedPath))
-			{
-				displayMessage("ERR: Could not open `" + path.string() + "' for writing: not a regular file");
-				return;
-			}
-		}
-		else
-		{
-			displayMessage("ERR: File exists (add ! to override)");
-			return;
-		}
+		return;
 	}
 
-	buffer.write(resolvedPath);
-	displayMessage("\"" + resolvedPath.string() + "\" " + std::to_string(buffer.numLines()) + " lines written");
-	modified = false;
+	lines.edit(editedLineIndex) = std::move(*editedLine).release();
+	editedLine.reset();
 }
 
-bool commandMatches(
-	std::string_view const command,
-	std::string_view const requiredPrefix,
-	std::string_view const fullCommand
-)
+bool Editor::Buffer::isBeingEdited(int idx) const
 {
-	return command.starts_with(requiredPrefix) && fullCommand.starts_with(command);
+	return editedLine.has_value() && editedLineIndex == idx;
+}
+
+void Editor::Buffer::attach(Observer* observer)
+{
+	observers.push_back(observer);
 }
 
-std::vector<std::string> Editor::parseCommand()
+void Editor::Buffer::detach(Observer* observer)
 {
-	if (cmdline == ":")
+	std::erase(observers, observer);
+}
+
+void Editor::Buffer::notifyObservers(int line, int removed, int inserted)
+{
+	for (auto observer: observers)
 	{
-		return {};
+		observer->linesChanged(line, removed, inserted);
 	}
+}
 
-	auto parsedCommand = std::vector<std::string>{};
+void Editor::Buffer::notifyEdit(int line, int byte, int removed, int inserted)
+{
+	for (auto observer: observers)
+	{
+		observer->lineEdited(line, byte, removed, inserted);
+	}
+}
 
-	auto firstSpace = cmdline.find(" ");
-	auto command = cmdline.substr(1, firstSpace - 1);
+void Editor::Buffer::Observer::lineEdited(int line, int, int, int)
+{
+	linesChanged(line, 1, 1);
+}
 
-	if (command.ends_with("!"))
+// Each run of deleted lines is a change of its own, the last run first, so
+// that the runs before it are still where the marks say.
+void Editor::Buffer::Observer::linesDeleted(int line, std::span<std::uint8_t const> marks)
+{
+	for (auto end = marks.size(); end > 0;)
 	{
-		parsedCommand.emplace_back(command.substr(0, command.length() - 1));
-		parsedCommand.push_back("!");
+		auto start = end;
+		while (start > 0 && marks[start - 1] != 0)
+		{
+			start--;
+		}
+		linesChanged(line + static_cast<int>(start), static_cast<int>(end - start), 0);
+		while (start > 0 && marks[start - 1] == 0)
+		{
+			start--;
+		}
+		end = start;
 	}
-	else
-	{
-		parsedCommand.emplace_back(command);
+}
+
+// *** //
+
+Editor::Editor()
+	: context{}
+	, editorWindow{{{gutterWidth, 0}, {0, context.get_rect().s.h - 1}}}
+	, lineNumbers({{0, 0}, {gutterWidth, context.get_rect().s.h - 1}})
+	, statusLine{{{0, context.get_rect().s.h - 1}, {}}}
+{
+	context.raw(true);
+	terminal::enableHardwareScrolling();
+	terminal::enableBracketedPaste();
+	terminal::enableNonBlockingInput();
+	textArea = editorWindow.get_rect().s;
+	heightIndex.setWrapWidth(wrap ? textArea.w : 0);
+	setWindowColors();
+	context.refresh();
+	repaintPending = true;
+}
+
+void Editor::setWindowColors()
+{
+	editorWindow.setbackground(ncurses::Color::White, ncurses::Color::Black);
+	editorWindow.setcolor(ncurses::Color::White, ncurses::Color::Black);
+	lineNumbers.setbackground(ncurses::Color::Gray, ncurses::Color::Black);
+	lineNumbers.setcolor(ncurses::Color::Gray, ncurses::Color::Black);
+}
+
+// Wide enough for the largest line number and a space, but never narrower
+// than the three digits the gutter always had.
+int Editor::getGutterWidth() const
+{
+	auto digits = 1;
+	for (auto n = buffer.numLines(); n >= 10; n /= 10)
+	{
+		digits++;
+	}
+	return std::max(3, digits) + 1;
+}
+
+// Lays the windows out anew for the current screen size and gutter width.
+// Only the wrap width changes for the height index; the line widths it has
+// measured stay valid.
+void Editor::placeWindows()
+{
+	{
+		auto lock = std::lock_guard{cursesMutex};
+		auto screenHeight = context.get_rect().s.h;
+		editorWindow = ncurses::Window{{{gutterWidth, 0}, {0, screenHeight - 1}}};
+		lineNumbers = ncurses::Window{{{0, 0}, {gutterWidth, screenHeight - 1}}};
+		statusLine = ncurses::Window{{{0, screenHeight - 1}, {}}};
+		setWindowColors();
+		textArea = editorWindow.get_rect().s;
+		renderer.invalidate();
+	}
+	heightIndex.setWrapWidth(wrap ? textArea.w : 0);
+	adjustViewport();
+	repaintPending = true;
+}
+
+Editor::~Editor()
+{
+	auto lock = std::lock_guard{cursesMutex};
+	terminal::disableBracketedPaste();
+}
+
+std::filesystem::path resolvePath(std::filesystem::path const& path)
+{
+	wordexp_t p;
+	wordexp(path.c_str(), &p, 0);
+	auto resolvedPath = std::filesystem::path{p.we_wordv[p.we_offs]};
+	wordfree(&p);
+	return resolvedPath;
+}
+
+void Editor::setMemoryLimit(std::size_t bytes)
+{
+	buffer.setMemoryLimit(bytes);
+}
+
+void Editor::follow(bool enable)
+{
+	follower.reset();
+	if (not enable)
+	{
+		return;
+	}
+	if (file == "")
+	{
+		displayMessage("ERR: No file name");
+		return;
+	}
+	if (detectCompression(file) != Compression::None)
+	{
+		displayMessage("ERR: Cannot follow compressed `" + file.string() + "'");
+		return;
+	}
+	// from where the file ended when the buffer last matched it, so that no
+	// line appended since is missed
+	auto stamp = fileStamp.has_value() ? fileStamp : FileStamp::of(file);
+	follower.emplace(file, stamp.has_value() ? stamp->size : 0);
+	if (not follower->isOpen())
+	{
+		follower.reset();
+		displayMessage("ERR: Could not follow `" + file.string() + "'");
+		return;
+	}
+	displayMessage("Following \"" + file.string() + "\"");
+	appendFollowed();
+}
+
+// Lines appended to the followed file go to the end of the buffer, the first
+// onto the last line should that have had no newline.  In Normal mode a
+// cursor on the last line stays on the last line.
+void Editor::appendFollowed()
+{
+	auto update = follower->readUpdate();
+	if (update.truncated)
+	{
+		displayMessage("\"" + file.string() + "\" was truncated");
+	}
+	if (not update.lines.empty())
+	{
+		auto atEnd = mode == Mode::Normal && (buffer.isEmpty() || cursor.line == buffer.numLines() - 1);
+		if (journal.has_value())
+		{
+			journal->setPaused(true);
+		}
+		auto line = buffer.numLines();
+		auto removed = 0;
+		if (update.continuesLastLine && not buffer.isEmpty())
+		{
+			buffer.endLineEdit();
+			line--;
+			removed = 1;
+			update.lines.front().insert(0, buffer.getLine(line));
+		}
+		buffer.replaceLines(line, removed, std::move(update.lines));
+		if (journal.has_value())
+		{
+			journal->setPaused(false);
+		}
+		fileDigest.reset();
+		if (atEnd)
+		{
+			cursor = {.line=buffer.numLines() - 1, .col=0};
+		}
+		adjustViewport();
+		repaintPending = true;
+	}
+	if (update.gone)
+	{
+		follower.reset();
+		displayMessage("\"" + file.string() + "\" went away; no longer following");
+	}
+}
+
+void Editor::appendLoaded()
+{
+	if (journal.has_value())
+	{
+		journal->setPaused(true);
+	}
+	auto status = buffer.loadMore();
+	if (journal.has_value())
+	{
+		journal->setPaused(false);
+	}
+	if (status == Decompressor::Status::Failed)
+	{
+		displayMessage("ERR: `" + file.string() + "' is corrupt or truncated; read up to line " + std::to_string(buffer.numLines()));
+	}
+	adjustViewport();
+	repaintPending = true;
+}
+
+void Editor::open(std::filesystem::path const& path, Force force)
+{
+	auto resolvedPath = resolvePath(path);
+	if (not std::filesystem::exists(resolvedPath))
+	{
+		displayMessage("ERR: Could not open `" + path.string() + "': file does not exist");
+		return;
+	}
+	if (not std::filesystem::is_regular_file(resolvedPath))
+	{
+		displayMessage("ERR: Could not open `" + path.string() + "': not a regular file");
+		return;
+	}
+	if (modified and force == Force::No)
+	{
+		displayMessage("ERR: No write since last change (add ! to override)");
+		return;
+	}
+	if (not isSupported(detectCompression(resolvedPath)))
+	{
+		displayMessage("ERR: Could not open `" + path.string() + "': built without support for its compression");
+		return;
+	}
+
+	if (resolvedPath != file)
+	{
+		fileDigest.reset();
+	}
+	file = resolvedPath;
+	syntaxIndex.setSyntax(syntaxFor(file));
+	follower.reset();
+	reload();
+}
+
+// Unless it was changed here, the buffer is only patched where the file's
+// digest says the file changed, keeping the cursor and cached layout; a
+// changed buffer, or one with no digest, is read from scratch.  Patching takes
+// a digest of the new version of the file first, which for a mapped file is
+// the only full read; a file that has crossed the size for mapping either way
+// is read from scratch.
+void Editor::reload()
+{
+	discardJournal();
+	auto stamp = FileStamp::of(file);
+	auto newDigest = std::optional<FileDigest>{};
+	if (not modified && fileDigest.has_value() && detectCompression(file) == Compression::None
+		&& buffer.isMapped() == buffer.wouldMap(file))
+	{
+		newDigest = FileDigest::of(file);
+	}
+	if (not newDigest.has_value())
+	{
+		buffer.clear();
+		buffer.read(file);
+		newDigest = buffer.isMapped() ? buffer.takeMappedDigest() : bufferDigest();
+	}
+	else
+	{
+		auto difference = fileDigest->compare(*newDigest);
+		buffer.reload(file, difference);
+		auto shift = [&difference](int line)
+		{
+			if (line >= difference.line + difference.removed)
+			{
+				return line + difference.inserted - difference.removed;
+			}
+			return std::min(line, difference.line + std::max(0, difference.inserted - 1));
+		};
+		cursor.line = shift(cursor.line);
+		windowInfo.topLine = std::min(shift(windowInfo.topLine), std::max(0, buffer.numLines() - 1));
+	}
+	modified = false;
+	fileDigest = std::move(newDigest);
+	rememberFile(stamp);
+	startJournal();
+
+	cursor.line = std::clamp(cursor.line, 0, std::max(0, buffer.numLines() - 1));
+	auto cursorLineLength = buffer.lineLength(cursor.line);
+	cursor.col = std::min(cursor.col, std::max(0, cursorLineLength - 1));
+	if (not buffer.isEmpty())
+	{
+		cursor.col = static_cast<int>(characterStart(buffer.getLineText(cursor.line), static_cast<std::size_t>(cursor.col)));
+	}
+	
+	adjustViewport();
+	repaintPending = true;
+}
+
+// Called once the buffer matches the file and fileDigest has been taken of it.
+// Should the file have changed since `before`, the digest may not describe the
+// buffer, and the next reload has to be a full one.
+void Editor::rememberFile(std::optional<FileStamp> before)
+{
+	fileStamp = FileStamp::of(file);
+	if (not before.has_value() || fileStamp != before)
+	{
+		fileDigest.reset();
+	}
+}
+
+// Taken of the buffer just read or written, which holds what the file does,
+// so that the file is not read again for it.  A mapped file gets none: its
+// digest is taken while it is mapped, and one of the buffer would be a second
+// full read of a large file.
+std::optional<FileDigest> Editor::bufferDigest() const
+{
+	if (buffer.isMapped() || detectCompression(file) != Compression::None)
+	{
+		return std::nullopt;
+	}
+	auto digest = FileDigest{};
+	for (auto i = 0; i < buffer.numLines(); i++)
+	{
+		digest.addLine(buffer.getLine(i));
+	}
+	digest.finish();
+	return digest;
+}
+
+// A swap file already there was left by a crash or is in use by another ved;
+// either way it is not ours to replace.
+void Editor::startJournal()
+{
+	discardJournal();
+	if (file.empty())
+	{
+		return;
+	}
+	auto swapPath = Journal::swapPathFor(file);
+	if (std::filesystem::exists(swapPath))
+	{
+		displayMessage("WARNING: Found swap file `" + swapPath.string() + "'; recover with ved -r or remove it");
+		return;
+	}
+	journal.emplace(buffer, swapPath, fileStamp);
+	if (not journal->isOpen())
+	{
+		journal.reset();
+	}
+}
+
+void Editor::discardJournal()
+{
+	if (journal.has_value())
+	{
+		journal->discard();
+		journal.reset();
+	}
+}
+
+void Editor::recover(std::filesystem::path const& path)
+{
+	open(path);
+	if (file.empty())
+	{
+		return;
+	}
+	if (buffer.isLoading())
+	{
+		buffer.loadMore(true);
+	}
+
+	auto swapPath = Journal::swapPathFor(file);
+	auto recovery = Journal::replay(swapPath, buffer, fileStamp);
+	if (not recovery.has_value())
+	{
+		displayMessage("ERR: Could not read swap file `" + swapPath.string() + "'");
+		return;
+	}
+	modified = recovery->changes > 0;
+	journal.emplace(buffer, swapPath, recovery->validLength);
+	if (not journal->isOpen())
+	{
+		journal.reset();
+	}
+
+	auto report = "Recovered " + std::to_string(recovery->changes) + " changes from `" + swapPath.string() + "'";
+	if (not recovery->baseMatches)
+	{
+		report += "; the file has changed since, check the result";
+	}
+	else if (not recovery->complete)
+	{
+		report += "; the last one was cut short";
+	}
+	displayMessage(report);
+
+	cursor.line = std::clamp(cursor.line, 0, std::max(0, buffer.numLines() - 1));
+	cursor.col = 0;
+	adjustViewport();
+	repaintPending = true;
+}
+
+void Editor::checkFile()
+{
+	if (file.empty() || follower.has_value() || not fileStamp.has_value())
+	{
+		return;
+	}
+	auto stamp = FileStamp::of(file);
+	if (stamp == fileStamp)
+	{
+		return;
+	}
+	if (not stamp.has_value())
+	{
+		fileStamp.reset();
+		displayMessage("WARNING: \"" + file.string() + "\" went away");
+		return;
+	}
+	if (modified)
+	{
+		fileStamp = stamp;
+		fileDigest.reset();
+		displayMessage("WARNING: \"" + file.string() + "\" changed on disk since it was read");
+		return;
+	}
+	reload();
+	displayMessage("\"" + file.string() + "\" changed on disk; reloaded");
+}
+
+void Editor::read(std::filesystem::path const& path, int afterLine)
+{
+	auto resolvedPath = resolvePath(path);
+	if (not std::filesystem::exists(resolvedPath))
+	{
+		displayMessage("ERR: Could not open `" + path.string() + "': file does not exist");
+		return;
+	}
+	if (not std::filesystem::is_regular_file(resolvedPath))
+	{
+		displayMessage("ERR: Could not open `" + path.string() + "': not a regular file");
+		return;
+	}
+
+	auto prevLines = std::max(1, buffer.numLines());  // reading into an empty buffer adds a blank line
+	buffer.read(resolvedPath, afterLine);
+	auto newLines = buffer.numLines() - prevLines;
+
+	modified = true;
+
+	repaintPending = true;
+
+	displayMessage("\"" + resolvedPath.string() + "\" " + std::to_string(newLines) + " lines read");
+}
+
+// The lines are replaced only once the command has succeeded, all at once.
+void Editor::filter(LineRange range, std::string const& command)
+{
+	auto count = range.last - range.first + 1;
+	auto error = std::string{};
+	auto output = buffer.filter(range.first, count, command, error);
+	if (not output.has_value())
+	{
+		displayMessage("ERR: " + error);
+		return;
+	}
+	auto newLines = static_cast<int>(output->size());
+	buffer.replaceLines(range.first, count, std::move(*output));
+	modified = true;
+
+	cursor = {.line=std::clamp(range.first, 0, std::max(0, buffer.numLines() - 1)), .col=0};
+	adjustViewport();
+	repaintPending = true;
+	displayMessage(std::to_string(count) + " lines filtered, " + std::to_string(newLines) + " out");
+}
+
+void Editor::readCommand(std::string const& command, int afterLine)
+{
+	auto error = std::string{};
+	auto output = runFilter(command, [](std::string&) { return false; }, error);
+	if (not output.has_value())
+	{
+		displayMessage("ERR: " + error);
+		return;
+	}
+	if (buffer.isEmpty())  // as when reading a file, a blank line goes first
+	{
+		buffer.insertLines(0, {""});
+		afterLine = 0;
+	}
+	auto newLines = static_cast<int>(output->size());
+	buffer.insertLines(afterLine + 1, std::move(*output));
+	modified = true;
+
+	repaintPending = true;
+	displayMessage(std::to_string(newLines) + " lines read from `" + command + "'");
+}
+
+// What the command prints can only be shown in the status line, so that is
+// its last line.  A range of no lines, as for a bare :!command, gives it no
+// input.
+void Editor::writeCommand(std::string const& command, std::optional<LineRange> range)
+{
+	auto lines = range.value_or(LineRange{.first=0, .last=buffer.numLines() - 1});
+	auto count = buffer.isEmpty() ? 0 : lines.last - lines.first + 1;
+	auto error = std::string{};
+	auto output = buffer.filter(std::max(lines.first, 0), count, command, error);
+	if (not output.has_value())
+	{
+		displayMessage("ERR: " + error);
+	}
+	else if (not output->empty())
+	{
+		displayMessage(output->back());
+	}
+	else if (count > 0)
+	{
+		displayMessage(std::to_string(count) + " lines written to `" + command + "'");
+	}
+	else
+	{
+		displayMessage("`" + command + "' printed nothing");
+	}
+}
+
+// Writing over another existing file takes a !, and so does writing only some
+// of the lines over the file itself.
+bool Editor::canWrite(std::filesystem::path const& path, std::filesystem::path const& resolvedPath, Force force, bool partial)
+{
+	if (partial && resolvedPath == file && force == Force::No)
+	{
+		displayMessage("ERR: Use ! to write part of the buffer over its file");
+		return false;
+	}
+	if (std::filesystem::exists(resolvedPath) && file != resolvedPath)
+	{
+		if (force == Force::Yes)
+		{
+			if (not std::filesystem::is_regular_file(resolvedPath))
+			{
+				displayMessage("ERR: Could not open `" + path.string() + "' for writing: not a regular file");
+				return false;
+			}
+		}
+		else
+		{
+			displayMessage("ERR: File exists (add ! to override)");
+			return false;
+		}
+	}
+
+	if (buffer.isLoading())
+	{
+		displayMessage("ERR: `" + file.string() + "' is still being read");
+		return false;
+	}
+	if (not isSupported(compressionFor(resolvedPath)))
+	{
+		displayMessage("ERR: Could not write `" + path.string() + "': built without support for its compression");
+		return false;
+	}
+	return true;
+}
+
+void Editor::write(std::filesystem::path const& path, Force force, std::optional<LineRange> range)
+{
+	if (range.has_value() && (buffer.isEmpty() || (range->first == 0 && range->last == buffer.numLines() - 1)))
+	{
+		range.reset();
+	}
+	auto resolvedPath = resolvePath(path);
+	if (not canWrite(path, resolvedPath, force, range.has_value()))
+	{
+		return;
+	}
+	if (range.has_value())
+	{
+		auto count = range->last - range->first + 1;
+		if (not buffer.write(resolvedPath, range->first, count))
+		{
+			displayMessage("ERR: Could not write `" + path.string() + "'");
+			return;
+		}
+		displayMessage("\"" + resolvedPath.string() + "\" " + std::to_string(count) + " lines written");
+		return;
+	}
+
+	if (not buffer.write(resolvedPath))
+	{
+		displayMessage("ERR: Could not write `" + path.string() + "'");
+		return;
+	}
+	displayMessage("\"" + resolvedPath.string() + "\" " + std::to_string(buffer.numLines()) + " lines written");
+	modified = false;
+	if (resolvedPath == file)
+	{
+		auto stamp = FileStamp::of(file);
+		fileDigest = bufferDigest();
+		rememberFile(stamp);
+		startJournal();
+	}
+}
+
+// Like dd, :d leaves the register alone; the lines go in a single splice.
+void Editor::deleteRange(LineRange range)
+{
+	auto count = range.last - range.first + 1;
+	buffer.deleteLines(range.first, count);
+	modified = true;
+
+	cursor = {.line=std::min(range.first, std::max(0, buffer.numLines() - 1)), .col=0};
+	adjustViewport();
+	repaintPending = true;
+	displayMessage(std::to_string(count) + " fewer lines");
+}
+
+void Editor::yankRange(LineRange range)
+{
+	auto count = range.last - range.first + 1;
+	buffer.yankTo(reg, range.first, count);
+	displayMessage(std::to_string(count) + " lines yanked");
+}
+
+// The lines are matched on every thread of the pool, each piece with a
+// substitution of its own and building the new text of its lines aside; the
+// buffer itself is only changed afterwards, in one go.
+void Editor::substitute(LineRange range, std::string_view command)
+{
+	auto substitution = Substitution(command, lastSearch);
+	if (not substitution.isValid())
+	{
+		displayMessage("ERR: " + substitution.error());
+		return;
+	}
+	lastSearch = substitution.patternText();
+
+	auto start = std::chrono::steady_clock::now();
+	auto count = std::min(range.last, buffer.numLines() - 1) - range.first + 1;
+	auto resultsMutex = std::mutex{};
+	auto pieces = std::vector<std::vector<std::pair<int, std::string>>>{};
+	auto substitutions = 0;
+	buffer.scan(range.first, count, threadPool, [&](int firstLine, std::span<std::string const> lines)
+	{
+		auto pieceSubstitution = Substitution(command, lastSearch);  // see Pattern
+		auto changed = std::vector<std::pair<int, std::string>>{};
+		auto found = 0;
+		for (auto i = std::size_t{0}; i < lines.size(); i++)
+		{
+			if (auto result = pieceSubstitution.apply(lines[i], found); result.has_value())
+			{
+				changed.emplace_back(firstLine + static_cast<int>(i), std::move(*result));
+			}
+		}
+		if (not changed.empty())
+		{
+			auto lock = std::lock_guard{resultsMutex};
+			pieces.push_back(std::move(changed));
+			substitutions += found;
+		}
+	});
+
+	if (pieces.empty())
+	{
+		displayMessage("ERR: Pattern not found");
+		return;
+	}
+	std::sort(pieces.begin(), pieces.end(), [](auto const& a, auto const& b) { return a.front().first < b.front().first; });
+	auto changes = std::move(pieces.front());
+	std::for_each(pieces.begin() + 1, pieces.end(), [&](auto& piece)
+	{
+		std::move(piece.begin(), piece.end(), std::back_inserter(changes));
+	});
+	auto lastChanged = changes.back().first;
+	auto linesChanged = changes.size();
+	buffer.changeLines(std::move(changes));
+	modified = true;
+
+	cursor = {.line=lastChanged, .col=0};
+	adjustViewport();
+	repaintPending = true;
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+	displayMessage(std::to_string(substitutions) + " substitutions on " + std::to_string(linesChanged)
+		+ " lines (" + std::to_string(elapsed.count()) + " ms)");
+}
+
+bool commandMatches(
+	std::string_view const command,
+	std::string_view const requiredPrefix,
+	std::string_view const fullCommand
+)
+{
+	return command.starts_with(requiredPrefix) && fullCommand.starts_with(command);
+}
+
+// :g is :global, but :go is :goto
+bool isGlobalCommand(std::string_view const command)
+{
+	return commandMatches(command, "g", "global") && not commandMatches(command, "go", "goto");
+}
+
+// :g/pattern/command, or :v for the lines not matching.  The lines are first
+// matched on every thread of the pool, each piece compiling the pattern for
+// itself, marking those the command applies to, and the command then goes
+// over the marked lines all at once: d, y, or w with a file name.
+void Editor::global(LineRange range, bool invert, std::string_view command)
+{
+	if (command.empty() || not isPatternDelimiter(command.front()))
+	{
+		displayMessage("ERR: Global command expects /pattern/command");
+		return;
+	}
+	auto delimiter = command.front();
+	command.remove_prefix(1);
+	auto patternText = takeDelimited(command, delimiter);
+	if (patternText.empty())
+	{
+		patternText = lastSearch;
+	}
+	if (patternText.empty())
+	{
+		displayMessage("ERR: No previous search pattern");
+		return;
+	}
+	auto pattern = Pattern(patternText);
+	if (not pattern.isValid())
+	{
+		displayMessage("ERR: " + pattern.error());
+		return;
+	}
+	lastSearch = patternText;
+
+	command.remove_prefix(std::min(command.find_first_not_of(' '), command.size()));
+	auto nameEnd = std::find_if_not(command.begin(), command.end(), [](unsigned char c) { return std::isalpha(c); });
+	auto name = std::string_view{command.begin(), nameEnd};
+	command.remove_prefix(name.size());
+	auto force = command.starts_with('!') ? Force::Yes : Force::No;
+	command.remove_prefix(force == Force::Yes ? 1 : 0);
+	command.remove_prefix(std::min(command.find_first_not_of(' '), command.size()));
+	command.remove_suffix(command.size() - std::min(command.find_last_not_of(' ') + 1, command.size()));
+	auto isWrite = commandMatches(name, "w", "write");
+	if (not commandMatches(name, "d", "delete") && not commandMatches(name, "y", "yank") && not isWrite)
+	{
+		displayMessage("ERR: Global command can only be d, y or w");
+		return;
+	}
+	if (not isWrite && (force == Force::Yes || not command.empty()))
+	{
+		displayMessage("ERR: Trailing characters");
+		return;
+	}
+	auto path = std::filesystem::path{isWrite && command.empty() ? file : std::filesystem::path{command}};
+	if (isWrite && path.empty())
+	{
+		displayMessage("ERR: No file name");
+		return;
+	}
+	if (isWrite && not canWrite(path, resolvePath(path), force, true))
+	{
+		return;
+	}
+
+	auto count = std::min(range.last, buffer.numLines() - 1) - range.first + 1;
+	auto marks = LineStore::Marks(static_cast<std::size_t>(count));
+	auto marked = std::atomic<int>{0};
+	buffer.scan(range.first, count, threadPool, [&](int firstLine, std::span<std::string const> lines)
+	{
+		auto piecePattern = Pattern(pattern.text());  // see Pattern
+		auto found = 0;
+		auto mark = marks.begin() + (firstLine - range.first);
+		for (auto& line: lines)
+		{
+			if (piecePattern.matches(line) != invert)
+			{
+				*mark = 1;
+				found++;
+			}
+			++mark;
+		}
+		marked += found;
+	});
+	if (marked == 0)
+	{
+		displayMessage(invert ? "ERR: Pattern found in every line" : "ERR: Pattern not found");
+		return;
+	}
+
+	if (isWrite)
+	{
+		auto resolvedPath = resolvePath(path);
+		if (not buffer.write(resolvedPath, range.first, marks))
+		{
+			displayMessage("ERR: Could not write `" + path.string() + "'");
+			return;
+		}
+		displayMessage("\"" + resolvedPath.string() + "\" " + std::to_string(marked) + " lines written");
+	}
+	else if (commandMatches(name, "y", "yank"))
+	{
+		buffer.yankTo(reg, range.first, marks);
+		displayMessage(std::to_string(marked) + " lines yanked");
+	}
+	else
+	{
+		auto firstMarked = range.first + static_cast<int>(std::find(marks.begin(), marks.end(), 1) - marks.begin());
+		buffer.deleteLines(range.first, marks);
+		modified = true;
+
+		cursor = {.line=std::min(firstMarked, std::max(0, buffer.numLines() - 1)), .col=0};
+		adjustViewport();
+		repaintPending = true;
+		displayMessage(std::to_string(marked) + " fewer lines");
+	}
+}
+
+// A command is an optional range, a command name of letters, an optional !
+// and one optional argument; for :s, :g, :v and :sort, everything after its
+// name and !, and for commands for the shell, everything after their !.
+std::optional<Editor::ParsedCommand> Editor::parseCommand()
+{
+	auto text = std::string_view{cmdline}.substr(1);
+	auto parsedCommand = ParsedCommand{.range=std::nullopt, .name={}, .force=Force::No, .arg=std::nullopt};
+	if (not parseRange(text, parsedCommand.range))
+	{
+		return std::nullopt;
+	}
+
+	auto nameEnd = std::find_if_not(text.begin(), text.end(), [](unsigned char c) { return std::isalpha(c); });
+	parsedCommand.name = std::string{text.begin(), nameEnd};
+	text.remove_prefix(static_cast<std::size_t>(nameEnd - text.begin()));
+	// commands for the shell are taken whole: :!command, and :r or :w followed
+	// by a blank and !command
+	auto& name = parsedCommand.name;
+	auto isReadOrWrite = commandMatches(name, "r", "read") || commandMatches(name, "w", "write");
+	auto command = text.substr(std::min(text.find_first_not_of(' '), text.size()));
+	if ((name.empty() && text.starts_with('!')) || (isReadOrWrite && text.starts_with(' ') && command.starts_with('!')))
+	{
+		// :r and :w keep the ! to tell the command from a file name
+		parsedCommand.arg = std::string{name.empty() ? command.substr(1) : command};
+		name = name.empty() ? "!" : name;
+		return parsedCommand;
+	}
+
+	// so are substitutions, global commands and sorts: they have their own
+	// delimiters or options, which may hold spaces
+	auto isVerbatim = isGlobalCommand(name) || commandMatches(name, "v", "vglobal")
+		|| commandMatches(name, "sor", "sort");
+	if (isVerbatim && text.starts_with('!'))
+	{
+		parsedCommand.force = Force::Yes;
+		text.remove_prefix(1);
+	}
+	if (isVerbatim || commandMatches(name, "s", "substitute"))
+	{
+		parsedCommand.arg = std::string{text};
+		return parsedCommand;
+	}
+	if (text.starts_with('!'))
+	{
+		parsedCommand.force = Force::Yes;
+		text.remove_prefix(1);
+	}
+
+	auto tailStart = text.find_first_not_of(" ");
+	if (tailStart != std::string_view::npos)
+	{
+		auto tail = text.substr(tailStart, text.find_last_not_of(" ") - tailStart + 1);
+		if (tail.find_first_of(" ") != std::string::npos)
+		{
+			displayMessage("ERR: Trailing characters");
+			return std::nullopt;
+		}
+		parsedCommand.arg = std::string{tail};
+	}
+
+	return parsedCommand;
+}
+
+void Editor::executeCommand()
+{
+	buffer.endLineEdit();
+	auto parsedCommand = parseCommand();
+	if (not parsedCommand.has_value())
+	{
+		return;
+	}
+
+	auto const& [range, command, force, arg] = *parsedCommand;
+	auto takesRange = commandMatches(command, "d", "delete") || commandMatches(command, "y", "yank")
+		|| commandMatches(command, "w", "write") || commandMatches(command, "r", "read")
+		|| commandMatches(command, "s", "substitute") || isGlobalCommand(command)
+		|| commandMatches(command, "v", "vglobal") || commandMatches(command, "sor", "sort")
+		|| commandMatches(command, "uni", "uniq") || command == "!";
+	if (range.has_value() && not takesRange && not command.empty())
+	{
+		displayMessage("ERR: No range allowed");
+		return;
+	}
+	// only reading goes after line 0; everything else takes it for line 1
+	auto lines = range.value_or(LineRange{.first=cursor.line, .last=cursor.line});
+	if (not commandMatches(command, "r", "read"))
+	{
+		lines.first = std::max(lines.first, 0);
+		lines.last = std::max(lines.last, 0);
+	}
+
+	if (command.empty())
+	{
+		if (force == Force::Yes || arg.has_value())
+		{
+			displayMessage("ERR: Trailing characters");
+		}
+		else if (range.has_value() && not buffer.isEmpty())
+		{
+			cursor = {.line=lines.last, .col=0};
+			adjustViewport();
+			repaintPending = true;
+		}
+	}
+	else if (commandMatches(command, "d", "delete"))
+	{
+		if (force == Force::Yes || arg.has_value())
+		{
+			displayMessage("ERR: Trailing characters");
+		}
+		else if (not buffer.isEmpty())
+		{
+			deleteRange(lines);
+		}
+	}
+	else if (commandMatches(command, "y", "yank"))
+	{
+		if (force == Force::Yes || arg.has_value())
+		{
+			displayMessage("ERR: Trailing characters");
+		}
+		else if (not buffer.isEmpty())
+		{
+			yankRange(lines);
+		}
+	}
+	else if (isGlobalCommand(command) || commandMatches(command, "v", "vglobal"))
+	{
+		// without a range, all lines
+		if (not buffer.isEmpty())
+		{
+			auto invert = commandMatches(command, "v", "vglobal") || force == Force::Yes;
+			global(range.has_value() ? lines : LineRange{.first=0, .last=buffer.numLines() - 1}, invert, arg.value_or(""));
+		}
+	}
+	else if (command == "!")
+	{
+		if (arg->empty())
+		{
+			displayMessage("ERR: No command");
+		}
+		else if (range.has_value() && not buffer.isEmpty())
+		{
+			filter(lines, *arg);
+		}
+		else
+		{
+			writeCommand(*arg, LineRange{.first=0, .last=-1});
+		}
 	}
-
-	if (firstSpace != std::string::npos)
+	else if (commandMatches(command, "sor", "sort") || commandMatches(command, "uni", "uniq"))
 	{
-		auto tailStart = cmdline.find_first_not_of(" ", firstSpace);
-		if (tailStart != std::string::npos)
+		// without a range, all lines
+		if (commandMatches(command, "uni", "uniq") && (force == Force::Yes || arg.has_value()))
+		{
+			displayMessage("ERR: Trailing characters");
+		}
+		else if (buffer.numLines() > 1)
 		{
-			auto tail = cmdline.substr(tailStart, cmdline.find_last_not_of(" "));
-			if (tail.find_first_of(" ") != std::string::npos)
+			auto all = range.has_value() ? lines : LineRange{.first=0, .last=buffer.numLines() - 1};
+			if (commandMatches(command, "uni", "uniq"))
+			{
+				uniqLines(all);
+			}
+			else
 			{
-				displayMessage("ERR: Trailing characters");
-				return {};
+				sortLines(all, force, arg.value_or(""));
 			}
-			parsedCommand.emplace_back(tail);
 		}
 	}
-
-	return parsedCommand;
-}
-
-void Editor::executeCommand()
-{
-	auto parsedCommand = parseCommand();
-	if (parsedCommand.empty())
-	{
-		return;
-	}
-
-	statusLine.erase();
-
-	auto const& command = parsedCommand[0];
-	auto numTokens = parsedCommand.size();
-	auto force = Force::No;
-	if (numTokens > 1 && parsedCommand[1] == "!")
-	{
-		force = Force::Yes;
-	}
-	auto arg = std::optional<std::string>{};
-	if (numTokens > 1 && parsedCommand[numTokens-1] != "!")
+	else if (commandMatches(command, "s", "substitute"))
 	{
-		arg = parsedCommand[numTokens-1];
+		if (not buffer.isEmpty())
+		{
+			substitute(lines, arg.value_or(""));
+		}
 	}
-
-	if (commandMatches(command, "f", "file"))
+	else if (commandMatches(command, "f", "file"))
 	{
 		if (force == Force::Yes || arg.has_value())
 		{
@@ -407,6 +1633,7 @@ void Editor::executeCommand()
 		}
 		else
 		{
+			discardJournal();
 			quit = true;
 		}
 	}
@@ -427,13 +1654,18 @@ void Editor::executeCommand()
 	}
 	else if (commandMatches(command, "w", "write"))
 	{
-		if (arg.has_value())
+		auto partial = range.has_value() ? std::optional{lines} : std::nullopt;
+		if (arg.has_value() && arg->starts_with('!'))
+		{
+			writeCommand(arg->substr(1), partial);
+		}
+		else if (arg.has_value())
 		{
-			write(*arg);
+			write(*arg, force, partial);
 		}
 		else if (file != "")
 		{
-			write(file, force);
+			write(file, force, partial);
 		}
 		else
 		{
@@ -446,49 +1678,147 @@ void Editor::executeCommand()
 		{
 			displayMessage("ERR: No ! allowed");
 		}
+		else if (arg.has_value() && arg->starts_with('!'))
+		{
+			readCommand(arg->substr(1), lines.last);
+		}
 		else if (arg.has_value())
 		{
-			read(*arg);
+			read(*arg, lines.last);
 		}
 		else
 		{
 			displayMessage("ERR: No file name");
 		}
 	}
+	else if (commandMatches(command, "fo", "follow"))
+	{
+		if (force == Force::Yes || arg.has_value())
+		{
+			displayMessage("ERR: Trailing characters");
+		}
+		else if (follower.has_value())
+		{
+			follow(false);
+			displayMessage("Stopped following \"" + file.string() + "\"");
+		}
+		else
+		{
+			follow(true);
+		}
+	}
+	else if (commandMatches(command, "se", "set"))
+	{
+		if (force == Force::Yes)
+		{
+			displayMessage("ERR: No ! allowed");
+		}
+		else if (arg == "wrap" || arg == "nowrap")
+		{
+			setWrap(arg == "wrap");
+		}
+		else if (arg.has_value())
+		{
+			displayMessage("ERR: Unknown option: " + *arg);
+		}
+		else
+		{
+			displayMessage(wrap ? "wrap" : "nowrap");
+		}
+	}
+	else if (commandMatches(command, "go", "goto"))
+	{
+		if (force == Force::Yes)
+		{
+			displayMessage("ERR: No ! allowed");
+		}
+		else
+		{
+			goToByte(arg.value_or("1"));
+		}
+	}
 	else
 	{
 		displayMessage("ERR: Not an editor command: " + command);
 	}
 }
 
+// :goto N puts the cursor on byte N of the file, counting from 1 and each
+// line's newline included; one past the end goes to the last character.
+void Editor::goToByte(std::string_view text)
+{
+	auto byte = std::int64_t{0};
+	auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), byte);
+	if (error != std::errc{} || end != text.data() + text.size())
+	{
+		displayMessage("ERR: goto expects a byte number");
+		return;
+	}
+	if (buffer.isEmpty())
+	{
+		return;
+	}
+	auto line = std::min(offsetIndex.lineAtByte(std::max(byte - 1, std::int64_t{0})), buffer.numLines() - 1);
+	auto const& lineText = buffer.getLine(line);
+	auto col = static_cast<std::size_t>(std::max(byte - 1 - offsetIndex.start(line).bytes, std::int64_t{0}));
+	col = characterStart(lineText, std::min(col, previousCharacter(lineText, lineText.length())));
+	cursor = {.line=line, .col=static_cast<int>(col)};
+	adjustViewport();
+	repaintPending = true;
+}
+
+void Editor::setWrap(bool newWrap)
+{
+	wrap = newWrap;
+	windowInfo.leftCol = 0;
+	heightIndex.setWrapWidth(wrap ? textArea.w : 0);
+	adjustViewport();
+	repaintPending = true;
+}
+
 void Editor::doSearch()
 {
 	auto searchString = cmdline.substr(1);
+	if (searchString.empty())
+	{
+		searchString = lastSearch;
+	}
+	if (searchString.empty())
+	{
+		displayMessage("ERR: No previous search pattern");
+		return;
+	}
+	auto pattern = Pattern(searchString);
+	if (not pattern.isValid())
+	{
+		displayMessage("ERR: " + pattern.error());
+		return;
+	}
+	lastSearch = searchString;
 
 	for (auto line = cursor.line; line < buffer.numLines(); line++)
 	{
-		auto startPos = line == cursor.line ? static_cast<std::size_t>(cursor.col + 1) : 0;
-		if (
-			auto pos = buffer.getLine(line).find(searchString, startPos);
-			pos != std::string::npos
-		)
+		auto const& text = buffer.getLine(line);
+		auto col = static_cast<std::size_t>(cursor.col);
+		auto startPos = line == cursor.line ? std::max(nextCharacter(text, col), col + 1) : 0;
+		if (auto match = pattern.find(text, startPos); match.has_value())
 		{
 			cursor.line = line;
-			cursor.col = static_cast<int>(pos);
+			cursor.col = static_cast<int>(match->offset);
 			adjustViewport();
-			repaint();
+			repaintPending = true;
 			return;
 		}
 	}
 
 	for (auto line = 0; line <= cursor.line; line++)
 	{
-		if (auto pos = buffer.getLine(line).find(searchString); pos != std::string::npos)
+		if (auto match = pattern.find(buffer.getLine(line)); match.has_value())
 		{
 			cursor.line = line;
-			cursor.col = static_cast<int>(pos);
+			cursor.col = static_cast<int>(match->offset);
 			adjustViewport();
-			repaint();
+			repaintPending = true;
 			displayMessage("search hit BOTTOM, continuing at TOP");
 			return;
 		}
@@ -502,20 +1832,26 @@ void Editor::handleKey(ncurses::Key k)
 	switch (mode)
 	{
 		case Mode::Normal:
-			if (normalOps.contains(k))
+			// whatever follows r is the replacement character, and what follows m
+			// or ' names a mark
+			if (auto takesNextKey = pendingOperator == ncurses::Key{'r'} || pendingOperator == ncurses::Key{'m'}
+				|| pendingOperator == ncurses::Key{'\''}; takesNextKey || normalOps.contains(k))
 			{
-				auto res = normalOps[k]({
-					.key=k, .context=context, .buffer=buffer, .reg=reg,
-					.cursor=cursor, .windowInfo=windowInfo, .currentMode=mode,
+				auto op = takesNextKey ? normalOps[pendingOperator] : normalOps[k];
+				auto res = op({
+					.key=k, .buffer=buffer, .reg=reg,
+					.cursor=cursor, .windowInfo=windowInfo, .layout=layout, .heights=heightIndex, .offsets=offsetIndex,
+					.marks=markIndex,
+					.currentMode=mode,
 					.pendingOperator=pendingOperator,
 					.count=operatorCount
 				});
 
 				pendingOperator = res.pendingOperator;
 
-				if (operatorCount.has_value() && not res.count.has_value())  // clear count indication
+				if (operatorCount != res.count)  // update count indication
 				{
-					displayMessage("");
+					repaintPending = true;
 				}
 
 				operatorCount = res.count;
@@ -525,12 +1861,16 @@ void Editor::handleKey(ncurses::Key k)
 					modified = true;
 				}
 				auto needToRepaint = res.bufferChanged;
+				if (res.viewportMoved)
+				{
+					windowInfo = res.windowInfo;
+					needToRepaint = true;
+				}
 				if (res.cursorMoved)
 				{
 					cursor = res.cursorPosition;
 					adjustViewport();
 					needToRepaint = true;
-					editorWindow.move(getScreenCursorPosition());
 				}
 				if (res.modeChanged)
 				{
@@ -556,38 +1896,35 @@ void Editor::handleKey(ncurses::Key k)
 				}
 				if (needToRepaint)
 				{
-					repaint();
+					repaintPending = true;
 				}
 
 				if (res.message != "")
 				{
 					displayMessage(res.message);
 				}
-				else if (operatorCount.has_value())
-				{
-					statusLine.erase();
-					statusLine.mvaddstr({statusLine.get_rect().s.w - 10, 0}, std::to_string(*operatorCount));
-					statusLine.refresh();
-					editorWindow.refresh();  // return cursor to editor
-				}
 			}
 			break;
 
 		case Mode::Insert:
 			if (insertOps.contains(k))
 			{
-				auto res = insertOps[k]({k, context, buffer, reg, cursor, windowInfo, mode});
+				auto res = insertOps[k]({k, buffer, reg, cursor, windowInfo, layout, heightIndex, offsetIndex, markIndex, mode});
 				if (res.bufferChanged)
 				{
 					modified = true;
 				}
 				auto needToRepaint = res.bufferChanged;
+				if (res.viewportMoved)
+				{
+					windowInfo = res.windowInfo;
+					needToRepaint = true;
+				}
 				if (res.cursorMoved)
 				{
 					cursor = res.cursorPosition;
 					adjustViewport();
 					needToRepaint = true;
-					editorWindow.move(getScreenCursorPosition());
 				}
 				if (res.modeChanged)
 				{
@@ -596,20 +1933,20 @@ void Editor::handleKey(ncurses::Key k)
 				}
 				if (needToRepaint)
 				{
-					repaint();
+					repaintPending = true;
 				}
 			}
 			else
 			{
 				auto ch = k.keycode;
-				if (ch < 256 && (std::isprint(ch) || ch < 040))
+				if (ch < 256 && (std::isprint(ch) || ch < 040 || ch >= 0200))  // UTF-8 comes a byte at a time
 				{
 					buffer.insert(cursor, static_cast<char>(ch), 1);
 					cursor.col++;
 					modified = true;
 				}
 				adjustViewport();
-				repaint();
+				repaintPending = true;
 			}
 			break;
 
@@ -626,7 +1963,7 @@ void Editor::handleKey(ncurses::Key k)
 				if (res.modeChanged)
 				{
 					mode = res.newMode;
-					repaint();
+					repaintPending = true;
 
 					if (cmdline.starts_with(':'))
 					{
@@ -643,7 +1980,7 @@ void Editor::handleKey(ncurses::Key k)
 				}
 				if (needToRepaint)
 				{
-					repaint();
+					repaintPending = true;
 				}
 
 				if (res.message != "")
@@ -659,96 +1996,205 @@ void Editor::handleKey(ncurses::Key k)
 					cmdline += static_cast<char>(ch);
 					cmdlineCursor++;
 				}
-				repaint();
+				repaintPending = true;
 			}
 			break;
 	}
+
+	// typing goes through a gap buffer holding the line under the cursor
+	if (mode == Mode::Insert)
+	{
+		buffer.beginLineEdit(cursor.line);
+	}
+	else
+	{
+		buffer.endLineEdit();
+	}
 }
 
-void Editor::repaint()
+// The style of every byte of a line in [from, to), or nothing if it has no
+// tokens there.
+std::vector<Style> styleBytes(std::vector<Token> const& tokens, std::size_t from, std::size_t to)
 {
-	editorWindow.erase();
-	lineNumbers.erase();
-	
-	assert(windowInfo.leftCol >= 0);
-	auto leftEdge = static_cast<std::size_t>(windowInfo.leftCol);
+	auto styles = std::vector<Style>{};
+	for (auto [offset, tokenLength, style]: tokens)
+	{
+		auto start = std::clamp(offset, from, to);
+		auto end = std::clamp(offset + tokenLength, from, to);
+		if (start == end)
+		{
+			continue;
+		}
+		styles.resize(to - from, Style::Plain);
+		std::fill(styles.begin() + static_cast<std::ptrdiff_t>(start - from),
+			styles.begin() + static_cast<std::ptrdiff_t>(end - from), style);
+	}
+	return styles;
+}
 
-	auto lineY = 0;
-	for (auto i = windowInfo.topLine; i < buffer.numLines(); i++)
+// Runs of text in one style other than plain, with the columns they start at;
+// tabs are left out, as they only move the text after them along.  A character
+// takes the style of its first byte.
+std::vector<Frame::StyledSpan> Editor::styledSpans(std::string_view text, std::vector<Style> const& styles)
+{
+	auto spans = std::vector<Frame::StyledSpan>{};
+	auto column = 0;
+	for (auto i = std::size_t{0}; i < styles.size();)
 	{
-		if (wrap)
+		auto c = decodeUtf8(text, i);
+		auto isSpanned = styles[i] != Style::Plain && text[i] != '\t';
+		if (isSpanned && (spans.empty() || spans.back().offset + spans.back().length != i || spans.back().style != styles[i]))
 		{
-			editorWindow.mvaddstr({0, lineY}, buffer.getLine(i));
+			spans.push_back({.offset=i, .length=0, .column=column, .style=styles[i]});
 		}
-		else
+		if (isSpanned)
 		{
-			if (buffer.lineLength(i) > windowInfo.leftCol)
-			{
-				editorWindow.mvaddnstr(
-					{0, lineY},
-					buffer.getLine(i).substr(leftEdge),
-					editorWindow.get_rect().s.w
-				);
-			}
+			spans.back().length += c.length;
 		}
-		auto lineNumber = std::to_string(i + 1);
-		auto x = 3 - static_cast<int>(lineNumber.length());
-		lineNumbers.mvaddnstr({x, lineY}, lineNumber, lineNumbers.get_rect().s.w-1);
-		lineY += getLineVirtualHeight(buffer.getLine(i));
+		column = visibleUtf8CharLengthAccumulate(column, c);
+		i += c.length;
+	}
+	return spans;
+}
+
+// Copies `count` bytes of a line's text from `pos` on, or as many as there are.
+std::string copyLineText(Editor::Buffer::LineText lineText, std::size_t pos, std::size_t count)
+{
+	auto& [head, tail] = lineText;
+	auto text = std::string{};
+	if (pos < head.length())
+	{
+		text = head.substr(pos, count);
+	}
+	auto tailPos = std::max(pos, head.length()) - head.length();
+	if (tailPos < tail.length() && text.length() < count)
+	{
+		text += tail.substr(tailPos, count - text.length());
 	}
-	for (auto y = lineY; y < editorWindow.get_rect().s.h; y++)
+	return text;
+}
+
+void Editor::repaint()
+{
+	if (auto width = getGutterWidth(); width != gutterWidth)
 	{
-		editorWindow.mvaddstr({0, y}, "~");
+		gutterWidth = width;
+		placeWindows();
 	}
+	updateLayout();
+
+	auto frame = Frame{.layout=layout, .wrap=wrap};
 
-	lineNumbers.refresh();
+	// no line of ASCII can show more bytes than it has screen cells
+	assert(textArea.w >= 0);
+	auto width = static_cast<std::size_t>(textArea.w);
+	auto screenHeight = layout.rows.size();
+	frame.text.reserve(screenHeight);
+	frame.styles.resize(screenHeight);
+	for (auto y = std::size_t{0}; auto [i, segment]: layout.rows)
+	{
+		if (i >= 0 && segment == 0)
+		{
+			// only the lines on screen are lexed, and styled only as far as shown
+			auto textStyles = std::vector<Style>{};
+			if (wrap)
+			{
+				auto cells = (screenHeight - y) * width;
+				if (columnIndex.isAscii(i))
+				{
+					frame.text.push_back(copyLineText(buffer.getLineText(i), 0, cells));
+				}
+				else
+				{
+					auto end = columnIndex.byteAt(i, static_cast<int>(cells)).byte;
+					frame.text.push_back(copyLineText(buffer.getLineText(i), 0, static_cast<std::size_t>(end)));
+					maskUnshowable(frame.text.back());
+				}
+				auto shown = frame.text.back().length();
+				textStyles = styleBytes(syntaxIndex.tokens(i, shown), 0, shown);
+			}
+			else
+			{
+				auto from = static_cast<std::size_t>(columnIndex.byteAt(i, windowInfo.leftCol).byte);
+				auto to = static_cast<std::size_t>(columnIndex.byteAt(i, windowInfo.leftCol + textArea.w).byte);
+				auto lineStyles = styleBytes(syntaxIndex.tokens(i, to), from, to);
+				frame.text.push_back(getUnwrappedText(i, lineStyles, textStyles));
+			}
+			frame.styles[y] = styledSpans(frame.text.back(), textStyles);
+		}
+		else
+		{
+			frame.text.emplace_back();
+		}
+		y++;
+	}
 
-	statusLine.erase();
 	switch (mode)
 	{
 		case Mode::Normal:
+			if (operatorCount.has_value())
+			{
+				frame.status = std::to_string(*operatorCount);
+				frame.statusCol = context.get_rect().s.w - 10;
+			}
+			else
+			{
+				frame.status = message;
+			}
+			frame.cursor = getScreenCursorPosition();
 			break;
 
 		case Mode::Insert:
-			statusLine.mvaddstr({0,0}, "-- INSERT --");
+			frame.status = "-- INSERT --";
+			frame.cursor = getScreenCursorPosition();
 			break;
 
 		case Mode::Command:
-			statusLine.mvaddstr({0,0}, cmdline);
+			frame.status = cmdline;
+			frame.cursor = {cmdlineCursor, 0};
+			frame.cursorOnStatusLine = true;
 			break;
 	}
-	statusLine.refresh();
+	message.clear();  // messages last until the next frame
 
-	editorWindow.refresh();
+	renderer.submit(std::move(frame));
+}
 
-	switch (mode)
-	{
-		case Mode::Normal:
-		case Mode::Insert:
-			editorWindow.move(getScreenCursorPosition());
-			break;
+void Editor::updateLayout()
+{
+	auto screenHeight = static_cast<std::size_t>(textArea.h);
 
-		case Mode::Command:
-			statusLine.move({cmdlineCursor, 0});
-			break;
+	layout.rows.clear();
+	layout.topLine = windowInfo.topLine;
+	layout.bottomLine = windowInfo.topLine;
+	for (auto line = windowInfo.topLine; line < buffer.numLines() && layout.rows.size() < screenHeight; line++)
+	{
+		auto height = heightIndex.height(line);
+		for (auto segment = 0; segment < height && layout.rows.size() < screenHeight; segment++)
+		{
+			layout.rows.push_back({.line=line, .segment=segment});
+		}
+		if (layout.rows.back().segment == height - 1)
+		{
+			layout.bottomLine = line;
+		}
 	}
+	layout.rows.resize(screenHeight, {.line=-1, .segment=0});
 }
 
-void Editor::displayMessage(std::string_view message)
+void Editor::displayMessage(std::string_view newMessage)
 {
-	statusLine.clear();
-	statusLine.mvaddstr({}, message);
-	statusLine.refresh();
-	editorWindow.refresh();
+	message = newMessage;
+	repaintPending = true;
 }
 
-int visibleCharLengthAccumulate(int accumulator, char c)
+int Editor::visibleCharLengthAccumulate(int accumulator, char c)
 {
 	if (c == '\t')
 	{
 		return accumulator + 8 - (accumulator % 8);
 	}
-	if (c < 040)  // 000 NUL to 037 US
+	if ((c >= 0 && c < 040) || c == 0177)  // 000 NUL to 037 US, and DEL, shown as ^@ to ^_ and ^?
 	{
 		return accumulator + 2;
 	}
@@ -756,27 +2202,31 @@ int visibleCharLengthAccumulate(int accumulator, char c)
 	return accumulator + 1;
 }
 
-int Editor::getLineLength(std::string_view lineContents) const
-{
-	return std::accumulate(lineContents.begin(), lineContents.end(), 0, visibleCharLengthAccumulate);
-}
-
-int ceilingDivide(int divident, int divisor)
+int Editor::visibleUtf8CharLengthAccumulate(int accumulator, Utf8Char c)
 {
-	auto quotient = divident / divisor;
-	auto remainder = divident % divisor;
-	return quotient + (remainder ? 1 : 0);
+	if (c.codePoint < 0200)
+	{
+		return visibleCharLengthAccumulate(accumulator, static_cast<char>(c.codePoint));
+	}
+	return accumulator + displayWidth(c);
 }
 
-int Editor::getLineVirtualHeight(std::string_view lineContents) const
+int Editor::getLineLength(Buffer::LineText lineContents)
 {
-	if (not wrap)
+	auto& [head, tail] = lineContents;
+	if (isAscii(head) && isAscii(tail))
+	{
+		auto headLength = std::accumulate(head.begin(), head.end(), 0, visibleCharLengthAccumulate);
+		return std::accumulate(tail.begin(), tail.end(), headLength, visibleCharLengthAccumulate);
+	}
+	auto length = 0;
+	for (auto i = std::size_t{0}; i < lineContents.length();)
 	{
-		return 1;
+		auto c = decodeUtf8(lineContents, i);
+		length = visibleUtf8CharLengthAccumulate(length, c);
+		i += c.length;
 	}
-	auto width = editorWindow.get_rect().s.w;
-	assert(width > 0);
-	return std::max(1, ceilingDivide(getLineLength(lineContents), width));
+	return length;
 }
 
 void Editor::adjustViewport()
@@ -785,19 +2235,31 @@ void Editor::adjustViewport()
 	{
 		windowInfo.topLine = cursor.line;
 	}
-	while (getScreenCursorPosition().y >= editorWindow.get_rect().s.h)
+	else if (not buffer.isEmpty())
 	{
-		windowInfo.topLine++;
+		// Walk up from the cursor until the screen is full; this never looks at
+		// more than a screenful of lines, however far the cursor has jumped.
+		auto screenHeight = textArea.h;
+		auto rows = 1;
+		if (wrap)
+		{
+			rows += getCursorColumn() / textArea.w;
+		}
+		auto top = cursor.line;
+		while (top > windowInfo.topLine && rows + heightIndex.height(top - 1) <= screenHeight)
+		{
+			top--;
+			rows += heightIndex.height(top);
+		}
+		windowInfo.topLine = top;
 	}
 	if (not wrap)
 	{
-		while (cursor.col - windowInfo.leftCol >= editorWindow.get_rect().s.w)
+		// a cursor that went off the side comes back in the middle of the screen
+		auto column = buffer.isEmpty() ? 0 : getCursorColumn();
+		if (column < windowInfo.leftCol || column >= windowInfo.leftCol + textArea.w)
 		{
-			windowInfo.leftCol += 20;
-		}
-		while (windowInfo.leftCol > cursor.col)
-		{
-			windowInfo.leftCol -= 20;
+			windowInfo.leftCol = std::max(0, column - textArea.w / 2);
 		}
 	}
 }
@@ -815,17 +2277,14 @@ ncurses::Point Editor::getScreenCursorPosition() const
 
 	for (auto i = windowInfo.topLine; i < cursor.line; i++)
 	{
-		pos.y += getLineVirtualHeight(buffer.getLine(i));
+		pos.y += heightIndex.height(i);
 	}
 
-	auto& lineContents = buffer.getLine(cursor.line);
-	pos.x = std::accumulate(
-		lineContents.begin(), lineContents.begin() + cursor.col, 0, visibleCharLengthAccumulate
-	);
+	pos.x = getCursorColumn();
 	if (wrap)
 	{
-		pos.y += pos.x / editorWindow.get_rect().s.w;
-		pos.x = pos.x % editorWindow.get_rect().s.w;
+		pos.y += pos.x / textArea.w;
+		pos.x = pos.x % textArea.w;
 	}
 	else
 	{
@@ -834,27 +2293,182 @@ ncurses::Point Editor::getScreenCursorPosition() const
 	return pos;
 }
 
-int Editor::mainLoop()
+int Editor::getCursorColumn() const
 {
-	while (not quit)
+	assert(cursor.col >= 0);
+	return columnIndex.column(cursor.line, cursor.col);
+}
+
+// What of a line that is not wrapped shows between leftCol and the right edge,
+// with tabs spelled out as spaces, since the window would expand them from its
+// own left edge, and characters cut in two by either edge blanked out, so that
+// it is never wider than the window.  lineStyles, if it has any, starts at the
+// character at the left edge, and textStyles then gets the style of every byte
+// of the text.
+std::string Editor::getUnwrappedText(int line, std::vector<Style> const& lineStyles, std::vector<Style>& textStyles) const
+{
+	auto leftEdge = windowInfo.leftCol;
+	auto rightEdge = windowInfo.leftCol + textArea.w;
+	auto lineText = buffer.getLineText(line);
+	auto [byte, column] = columnIndex.byteAt(line, leftEdge);
+	auto first = static_cast<std::size_t>(byte);
+	auto i = first;
+
+	auto text = std::string{};
+	auto addText = [&](std::size_t count, char c, Style style)
+	{
+		text.append(count, c);
+		if (not lineStyles.empty())
+		{
+			textStyles.insert(textStyles.end(), count, style);
+		}
+	};
+	while (i < lineText.length() && column < rightEdge)
 	{
-		ncurses::Key ch;
-		switch(mode)
+		auto c = decodeUtf8(lineText, i);
+		auto next = visibleUtf8CharLengthAccumulate(column, c);
+		if (column < leftEdge || next > rightEdge || lineText[i] == '\t')
+		{
+			addText(static_cast<std::size_t>(std::min(next, rightEdge) - std::max(column, leftEdge)), ' ', Style::Plain);
+		}
+		else
 		{
-			case Mode::Normal:
-			case Mode::Insert:
-				ch = editorWindow.getch();
-				break;
+			for (auto k = i; k < i + c.length; k++)
+			{
+				addText(1, isShowable(c) ? lineText[k] : '?', lineStyles.empty() ? Style::Plain : lineStyles[k - first]);
+			}
+		}
+		column = next;
+		i += c.length;
+	}
+	return text;
+}
 
-			case Mode::Command:
-				ch = statusLine.getch();
-				break;
+// Waits for input without holding the curses lock, so that the render thread
+// can draw meanwhile, then takes everything that has arrived.
+ncurses::Key Editor::readKey()
+{
+	while (pendingKeys.empty())
+	{
+		// a line being typed in is journaled once typing pauses, and the file
+		// is looked at now and then even while no key comes
+		auto timeout = journal.has_value() && journal->hasDeferredLine()
+			? Journal::commitInterval : std::chrono::milliseconds{fileCheckInterval};
+		terminal::waitForInput(follower.has_value() ? follower->fd() : buffer.loadingFd(), static_cast<int>(timeout.count()));
+		if (journal.has_value())
+		{
+			journal->flushIfDue();
+		}
+		if (follower.has_value())
+		{
+			appendFollowed();
+		}
+		if (buffer.isLoading())
+		{
+			appendLoaded();
+		}
+		if (not isPasting)  // the paste goes in once all of it has come
+		{
+			checkFile();
+		}
+		{
+			auto lock = std::lock_guard{cursesMutex};
+			for (auto k = context.getch(); k != terminal::noKey; k = context.getch())
+			{
+				pendingKeys.push_back(k);
+			}
+		}
+		if (pendingKeys.empty() && repaintPending)  // the followed file grew
+		{
+			repaint();
+			repaintPending = false;
 		}
-		if (ch == ncurses::Key::Ctrl({'c'}))  // Ctrl+C
+	}
+	auto k = pendingKeys.front();
+	pendingKeys.pop_front();
+	return k;
+}
+
+bool Editor::hasPendingKeys() const
+{
+	return not pendingKeys.empty() || terminal::hasPendingInput();
+}
+
+void Editor::handlePaste()
+{
+	auto text = std::string{};
+	isPasting = true;
+	for (auto k = readKey(); k != terminal::pasteEnd; k = readKey())
+	{
+		if (k.keycode < 256)
 		{
+			text += static_cast<char>(k.keycode);
+		}
+	}
+	isPasting = false;
+
+	switch (mode)
+	{
+		case Mode::Normal:
+		case Mode::Insert:
+			if (not text.empty())
+			{
+				cursor = buffer.insertText(cursor, text);
+				if (mode == Mode::Normal)
+				{
+					cursor.col = static_cast<int>(previousCharacter(buffer.getLineText(cursor.line), static_cast<std::size_t>(cursor.col)));
+				}
+				modified = true;
+				adjustViewport();
+			}
+			break;
+
+		case Mode::Command:
+			std::erase_if(text, [](char c) { return not std::isprint(static_cast<unsigned char>(c)); });
+			cmdline += text;
+			cmdlineCursor += static_cast<int>(text.length());
 			break;
+	}
+	repaintPending = true;
+}
+
+int Editor::mainLoop()
+{
+	while (not quit)
+	{
+		if (repaintPending)
+		{
+			repaint();
+			repaintPending = false;
+		}
+
+		// apply everything that has already arrived before drawing another frame
+		do
+		{
+			auto ch = readKey();
+			if (ch == ncurses::Key::Ctrl({'c'}))  // Ctrl+C
+			{
+				// unsaved changes stay in the swap file
+				if (not modified)
+				{
+					discardJournal();
+				}
+				return 0;
+			}
+			if (ch == terminal::pasteStart)
+			{
+				handlePaste();
+			}
+			else if (ch == terminal::resizeKey)
+			{
+				placeWindows();
+			}
+			else
+			{
+				handleKey(ch);
+			}
 		}
-		handleKey(ch);
+		while (not quit && hasPendingKeys());
 	}
 	return 0;
 }
@@ -1,14 +1,41 @@
 #ifndef SRC_EDITOR_H_
 #define SRC_EDITOR_H_
 
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <filesystem>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <span>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <sys/types.h>
+
 #include "ncursespp/geometry.h"
 #include "ncursespp/ncurses.h"
 #include "ncursespp/window.h"
 
+#include "compression.h"
+#include "filedigest.h"
+#include "filter.h"
+#include "follower.h"
+#include "gapbuffer.h"
+#include "highlighter.h"
+#include "linestore.h"
+#include "renderer.h"
+#include "search.h"
+#include "substitution.h"
+#include "threadpool.h"
+#include "utf8.h"
+
 struct CursorPosition
 {
 	int line;
@@ -30,9 +57,13 @@ class Editor
 {
 public:
 	Editor();
+	~Editor();
 
 	int mainLoop();
 	void open(std::filesystem::path const&, Force = Force::No);
+	void setMemoryLimit(std::size_t bytes);
+	void follow(bool);
+	void recover(std::filesystem::path const&);  // replays the swap file left by a crash
 
 	struct Register
 	{
@@ -42,14 +73,43 @@ public:
 	class Buffer
 	{
 	public:
+		class Observer
+		{
+		public:
+			virtual ~Observer() = default;
+			// lines [line, line + removed) were replaced by `inserted` new ones
+			virtual void linesChanged(int line, int removed, int inserted) = 0;
+			// the lines from `line` on with their mark set went all at once; the
+			// first and last marks are set
+			virtual void linesDeleted(int line, std::span<std::uint8_t const> marks);
+			// bytes [byte, byte + removed) of the line were replaced by `inserted`
+			// new ones, as a key typed in Insert mode does; unless overridden the
+			// line is told as changed
+			virtual void lineEdited(int line, int byte, int removed, int inserted);
+		};
+
+		void attach(Observer*);
+		void detach(Observer*);
+
 		void erase(CursorPosition, int count);
 		void insert(CursorPosition, char, int count);
 		void insertLine(int line);
 		void breakLine(CursorPosition);
 		void joinLines(int line, int count);
 		void deleteLines(int line, int count);
+		void insertLines(int line, std::vector<std::string> newLines);
+		CursorPosition insertText(CursorPosition, std::string_view text);
+		void replaceLines(int line, int count, std::vector<std::string> newLines);
+		// Gives each listed line, in ascending order, its new text.
+		void changeLines(std::vector<std::pair<int, std::string>> changes);
+		// Deletes the marked lines of the run starting at `line` all at once.
+		void deleteLines(int line, LineStore::Marks const&);
+		// See LineStore::rearrange and hold.
+		void rearrangeLines(int line, int count, std::vector<int> const& order);
+		[[nodiscard]] bool holdLines(int line, int count);
 
 		void yankTo(Register&, int line, int count) const;
+		void yankTo(Register&, int line, LineStore::Marks const&) const;
 		void putFrom(Register const&, int line);
 
 		int numLines() const;
@@ -57,14 +117,355 @@ public:
 		bool isEmpty() const;
 		void clear();
 		void read(std::filesystem::path const&);
-		void read(std::filesystem::path const&, int line);
-		void write(std::filesystem::path const&) const;
+		void read(std::filesystem::path const&, int line);  // after line, or at the top for -1
+		[[nodiscard]] bool write(std::filesystem::path const&);
+		[[nodiscard]] bool write(std::filesystem::path const&, int line, int count);
+		[[nodiscard]] bool write(std::filesystem::path const&, int line, LineStore::Marks const&);
+		// The output of `command` run with lines [line, line + count) as input.
+		[[nodiscard]] std::optional<std::vector<std::string>> filter(
+			int line, int count, std::string const& command, std::string& error) const;
+		void reload(std::filesystem::path const&, FileDigest::Difference const&);
+
+		// A compressed file is decompressed in the background; its lines are
+		// appended as loadMore is called, once loadingFd turns readable.
+		bool isLoading() const;
+		int loadingFd() const;
+		Decompressor::Status loadMore(bool wait = false);
+
+		// Files too big to comfortably hold in memory are paged in from disk.
+		void setMemoryLimit(std::size_t bytes);
+		bool isMapped() const;
+		bool wouldMap(std::filesystem::path const&) const;
+		// See LineStore::takeDigest.
+		std::optional<FileDigest> takeMappedDigest();
+		static constexpr auto defaultMemoryLimit = std::size_t{256} << 20;
 
 		int lineLength(int idx) const;
 		std::string const& getLine(int idx) const;
+		void scan(int line, int count, ThreadPool&, LineStore::Visitor const&) const;
+
+		// The line being edited in Insert mode is kept in a gap buffer, so its
+		// text comes in two pieces; every other line is all head.
+		struct LineText
+		{
+			std::string_view head;
+			std::string_view tail{};
+
+			std::size_t length() const { return head.length() + tail.length(); }
+			char operator[](std::size_t i) const { return i < head.length() ? head[i] : tail[i - head.length()]; }
+		};
+		LineText getLineText(int idx) const;
+
+		void beginLineEdit(int line);
+		void endLineEdit();
 
 	private:
-		std::vector<std::string> lines{};
+		bool isBeingEdited(int idx) const;
+		void notifyObservers(int line, int removed, int inserted);
+		void notifyEdit(int line, int byte, int removed, int inserted);
+
+		LineStore lines{};
+		std::size_t memoryLimit{defaultMemoryLimit};
+		std::optional<Decompressor> decompressor{};
+
+		std::optional<GapBuffer> editedLine{};
+		int editedLineIndex{0};
+
+		std::vector<Observer*> observers{};
+	};
+
+	class ColumnIndex;
+
+	// Remembers the display width of the lines looked at lately, so that
+	// placing the viewport only measures lines that changed since they were
+	// last shown.  The number remembered is bounded, however long the buffer.
+	// Lines are measured by the column index, which keeps what it knows of a
+	// line being typed in up to where it changed.
+	class HeightIndex: public Buffer::Observer
+	{
+	public:
+		HeightIndex(Buffer&, ColumnIndex const&);
+		~HeightIndex() override;
+		HeightIndex(HeightIndex const&) = delete;
+		HeightIndex& operator=(HeightIndex const&) = delete;
+
+		void setWrapWidth(int width);  // 0 disables wrapping
+		int height(int line) const;
+
+		void linesChanged(int line, int removed, int inserted) override;
+		void linesDeleted(int line, std::span<std::uint8_t const> marks) override;
+
+	private:
+		int lineWidth(int line) const;
+
+		static constexpr auto maxCachedLines = std::size_t{1} << 16;
+
+		Buffer& buffer;
+		ColumnIndex const& columnIndex;
+		int wrapWidth{0};
+		mutable std::unordered_map<int, int> widths{};
+	};
+
+	// Display columns of the first character at or after every
+	// checkpointInterval-th byte of the lines asked about, so that finding what
+	// sits at a column far along a long line only measures the characters after
+	// the nearest checkpoint.  Checkpoints are placed as the line is first
+	// measured past them, and an edit within a line only drops those after it.
+	// Lines found to be all ASCII are measured a byte at a time from then on,
+	// with no decoding.
+	class ColumnIndex: public Buffer::Observer
+	{
+	public:
+		explicit ColumnIndex(Buffer&);
+		~ColumnIndex() override;
+		ColumnIndex(ColumnIndex const&) = delete;
+		ColumnIndex& operator=(ColumnIndex const&) = delete;
+
+		struct Position
+		{
+			int byte;
+			int column;
+		};
+		int column(int line, int byte) const;  // where the character covering the byte starts
+		Position byteAt(int line, int column) const;  // the character covering the column, or the end of the line
+		int width(int line) const;
+		bool isAscii(int line) const;
+
+		void linesChanged(int line, int removed, int inserted) override;
+		void linesDeleted(int line, std::span<std::uint8_t const> marks) override;
+		void lineEdited(int line, int byte, int removed, int inserted) override;
+
+	private:
+		struct Checkpoints
+		{
+			bool isAscii;
+			std::vector<Position> points;  // as far as the line has been measured
+		};
+		Checkpoints& checkpoints(int line) const;
+		// Measures from checkpoint number `from` on, for as long as `goesOn`
+		// holds for the next character, placing the checkpoints passed.
+		template<typename Predicate>
+		static Position walk(Checkpoints&, Buffer::LineText, std::size_t from, Predicate goesOn);
+
+		static constexpr auto checkpointInterval = 256;
+		static constexpr auto maxCachedLines = std::size_t{4096};
+
+		Buffer& buffer;
+		mutable std::unordered_map<int, Checkpoints> cache{};
+	};
+
+	// The lexer state each line ends in, so that highlighting a line only lexes
+	// that line.  States are found lazily, up to the lines asked about; after
+	// an edit, lines are lexed again from the edit on only until their states
+	// come out as before.  A line far past those known starts a fresh run some
+	// way above it, taken to start in the initial state, rather than having
+	// everything above it lexed.
+	class SyntaxIndex: public Buffer::Observer
+	{
+	public:
+		explicit SyntaxIndex(Buffer&);
+		~SyntaxIndex() override;
+		SyntaxIndex(SyntaxIndex const&) = delete;
+		SyntaxIndex& operator=(SyntaxIndex const&) = delete;
+
+		void setSyntax(Syntax);
+		std::vector<Token> tokens(int line, std::size_t end);  // of the bytes before end
+
+		void linesChanged(int line, int removed, int inserted) override;
+		void linesDeleted(int line, std::span<std::uint8_t const> marks) override;
+
+	private:
+		LexState startState(int line) const;  // of a line no further than one past those known
+		void lexUpTo(int line);
+		LexState lex(int line, LexState) const;
+
+		static constexpr auto lookahead = std::size_t{256};
+		static constexpr auto syncLines = 500;  // lexed above a line far from those known
+		static constexpr auto maxGap = 5000;  // lexed on through rather than starting afresh
+
+		Buffer& buffer;
+		Syntax syntax{Syntax::None};
+		int base{0};  // the first line with a known state
+		std::vector<LexState> endStates{};  // of lines base on
+
+		// Lines [dirtyFrom, dirtyTo) changed, so their states and those of the
+		// lines after them, up to where they come out as before, are stale.
+		bool isDirty{false};
+		int dirtyFrom{0};
+		int dirtyTo{0};
+	};
+
+	// Where each line starts, both as an offset into the file and as a count
+	// of the places the cursor stops at on the way there, so that a count of
+	// characters to move by or a byte to go to is turned into a line in
+	// O(log n).  Only sums per block of lines are kept, in a Fenwick tree that
+	// also counts the lines of each block; they are taken in one parallel scan
+	// the first time they are asked about, and the lines within a block are
+	// measured when needed.  Lines added or taken away change the counts of
+	// the blocks they fall in at once, and blocks whose lines changed are
+	// summed again when next asked about.
+	class OffsetIndex: public Buffer::Observer
+	{
+	public:
+		OffsetIndex(Buffer&, ThreadPool&);
+		~OffsetIndex() override;
+		OffsetIndex(OffsetIndex const&) = delete;
+		OffsetIndex& operator=(OffsetIndex const&) = delete;
+
+		struct Offset
+		{
+			std::int64_t bytes;  // each line ends in a newline
+			std::int64_t stops;  // the characters of a line, or 1 for an empty one
+		};
+		Offset start(int line) const;  // line may be numLines(), for the totals
+		// The line holding the offset, or numLines() if it is past the end.
+		int lineAtByte(std::int64_t byte) const;
+		int lineAtStop(std::int64_t stop) const;
+
+		void linesChanged(int line, int removed, int inserted) override;
+
+	private:
+		struct Sums
+		{
+			std::int64_t lines{0};
+			std::int64_t bytes{0};
+			std::int64_t stops{0};
+
+			void add(Sums const& s, std::int64_t sign = 1) { lines += sign * s.lines; bytes += sign * s.bytes; stops += sign * s.stops; }
+		};
+		static Sums measure(Buffer::LineText);
+		Sums measure(std::int64_t firstLine, std::int64_t lastLine) const;
+		void refresh() const;
+		void build() const;
+		void buildTree() const;
+		void forget();
+		void add(std::size_t block, Sums) const;
+		Sums before(std::size_t block) const;
+		// The block holding the offset, or blocks.size(), and the sums of those before it.
+		std::pair<std::size_t, Sums> find(std::int64_t offset, std::int64_t Sums::* member) const;
+		int lineAt(std::int64_t offset, std::int64_t Sums::* member) const;
+		void removeLines(std::int64_t line, std::int64_t count);
+		void insertLines(std::int64_t line, std::int64_t count);
+		void split(std::size_t block);
+		void markStale(std::size_t block);
+
+		static constexpr auto blockLines = std::int64_t{64};
+		static constexpr auto maxBlockLines = 2 * blockLines;  // more and the block is split
+		static constexpr auto maxStaleBlocks = std::size_t{1} << 10;  // more and all are measured again
+
+		Buffer& buffer;
+		ThreadPool& pool;
+		mutable bool isBuilt{false};
+		mutable std::vector<Sums> blocks{};
+		mutable std::vector<Sums> tree{};  // over blocks, from 1
+		mutable std::vector<std::size_t> staleBlocks{};
+	};
+
+	// Marks name lines and move with them as lines are added or taken away
+	// above, and go with the line they are on should it be deleted.  They are
+	// kept in a treap ordered by line, each node holding a shift still to be
+	// passed on to the nodes below it, so that a change moves all marks after
+	// it in O(log n) however many there are.  Named marks use their letter as
+	// their id.
+	class MarkIndex: public Buffer::Observer
+	{
+	public:
+		explicit MarkIndex(Buffer&);
+		~MarkIndex() override;
+		MarkIndex(MarkIndex const&) = delete;
+		MarkIndex& operator=(MarkIndex const&) = delete;
+
+		void set(int id, int line);
+		std::optional<int> line(int id) const;
+
+		void linesChanged(int line, int removed, int inserted) override;
+
+	private:
+		static constexpr auto none = ~std::size_t{0};
+		struct Node
+		{
+			int id;
+			int line;  // once the shifts of the nodes above are added
+			int shift;  // for the nodes below
+			std::minstd_rand::result_type priority;
+			std::size_t left{none};
+			std::size_t right{none};
+			std::size_t parent{none};
+		};
+		std::size_t newNode(int id, int line);
+		void freeTree(std::size_t node);
+		void shiftTree(std::size_t node, int by);
+		void pushShift(std::size_t node);
+		void adopt(std::size_t node);
+		// into the nodes before line and those from it on
+		std::pair<std::size_t, std::size_t> split(std::size_t node, int line);
+		std::size_t merge(std::size_t first, std::size_t second);
+		void unlink(std::size_t node);
+
+		Buffer& buffer;
+		std::vector<Node> nodes{};
+		std::vector<std::size_t> freeNodes{};
+		std::unordered_map<int, std::size_t> nodeOfId{};
+		std::size_t root{none};
+		std::minstd_rand priorities{};
+	};
+
+	// Appends every change to the buffer to a swap file next to the file, so
+	// that unsaved changes outlive a crash.  Changes are recorded on the input
+	// thread but written and synced in groups on a thread of the journal's own.
+	class Journal: public Buffer::Observer
+	{
+	public:
+		Journal(Buffer&, std::filesystem::path const& swapPath, std::optional<FileStamp> base);
+		Journal(Buffer&, std::filesystem::path const& swapPath, off_t resumeAt);  // after recovering
+		~Journal() override;  // leaves the swap file for recovery
+		Journal(Journal const&) = delete;
+		Journal& operator=(Journal const&) = delete;
+
+		bool isOpen() const;
+		void setPaused(bool);  // while the buffer takes in what is in the file
+		void discard();  // the changes were saved or thrown away: removes the swap file
+
+		void linesChanged(int line, int removed, int inserted) override;
+		void linesDeleted(int line, std::span<std::uint8_t const> marks) override;
+
+		// Whether a change within a line is yet to be recorded; it is once it
+		// is commitInterval old and flushIfDue is called.
+		bool hasDeferredLine() const;
+		void flushIfDue();
+
+		static std::filesystem::path swapPathFor(std::filesystem::path const&);
+
+		struct Recovery
+		{
+			int changes;
+			bool baseMatches;  // the file is still as it was when the journal began
+			bool complete;  // no torn or mismatched record at the end
+			off_t validLength;
+		};
+		static std::optional<Recovery> replay(
+			std::filesystem::path const& swapPath, Buffer&, std::optional<FileStamp> current);
+
+		static constexpr auto commitInterval = std::chrono::milliseconds{200};
+
+	private:
+		void run(std::stop_token);
+		void stop();
+		void record(int line, int removed, int inserted);
+		void flushDeferred();
+
+		Buffer& buffer;
+		std::filesystem::path swapPath;
+		int fd{-1};
+		bool paused{false};
+		std::optional<int> deferredLine{};
+		std::chrono::steady_clock::time_point deferredSince{};
+
+		std::mutex mutex{};
+		std::condition_variable_any pendingChanged{};
+		std::string pending{};
+
+		std::jthread thread{};
 	};
 
 	enum class Mode
@@ -75,37 +476,115 @@ public:
 private:
 	std::filesystem::path file;
 
+	ncurses::Key readKey();
+	bool hasPendingKeys() const;
+	std::deque<ncurses::Key> pendingKeys{};
 	void handleKey(ncurses::Key);
+	void handlePaste();
+	bool isPasting{false};
 	void repaint();
+	bool repaintPending{true};
 
-	void read(std::filesystem::path const&);
-	void write(std::filesystem::path const&, Force = Force::No);
+	// The lines an ex command applies to, counted from 0, both ends included.
+	struct LineRange
+	{
+		int first;
+		int last;
+	};
+
+	void read(std::filesystem::path const&, int afterLine);
+	void write(std::filesystem::path const&, Force = Force::No, std::optional<LineRange> = std::nullopt);
+	bool canWrite(std::filesystem::path const& path, std::filesystem::path const& resolvedPath, Force, bool partial);
+	// :range!command, :r !command and :w !command
+	void filter(LineRange, std::string const& command);
+	void readCommand(std::string const& command, int afterLine);
+	void writeCommand(std::string const& command, std::optional<LineRange>);
+	void deleteRange(LineRange);
+	void yankRange(LineRange);
+	void substitute(LineRange, std::string_view command);
+	void global(LineRange, bool invert, std::string_view command);
+	void sortLines(LineRange, Force reverse, std::string_view options);
+	void uniqLines(LineRange);
+	void goToByte(std::string_view);
+
+	std::optional<Follower> follower{};
+	void appendFollowed();
+	void appendLoaded();
+
+	// What the file looked like when the buffer last matched it.
+	std::optional<FileStamp> fileStamp{};
+	std::optional<FileDigest> fileDigest{};
+	void reload();
+	// Also done while waiting for keys, every fileCheckInterval.
+	void checkFile();
+	static constexpr auto fileCheckInterval = std::chrono::seconds{1};
+	void rememberFile(std::optional<FileStamp> before);
+	std::optional<FileDigest> bufferDigest() const;
+
+	void startJournal();
+	void discardJournal();
 
 	void executeCommand();
 	void doSearch();
-	std::vector<std::string> parseCommand();
+
+	struct ParsedCommand
+	{
+		std::optional<LineRange> range;
+		std::string name;
+		Force force;
+		std::optional<std::string> arg;
+	};
+	std::optional<ParsedCommand> parseCommand();
+	bool parseRange(std::string_view& text, std::optional<LineRange>& range);
+	bool parseAddress(std::string_view& text, int current, std::optional<int>& line);
+	std::optional<int> findLine(Pattern const&, int from, bool backward) const;
+	std::string lastSearch{};
 	void displayMessage(std::string_view message);
 
 	ncurses::Ncurses context;
 
+	int gutterWidth{4};
+	int getGutterWidth() const;
+	void placeWindows();
+	void setWindowColors();
+
 	ncurses::Window editorWindow;
 	ncurses::Window lineNumbers;
 	ncurses::Window statusLine;
+	std::mutex cursesMutex{};
+	Renderer renderer{editorWindow, lineNumbers, statusLine, cursesMutex};
+
+	ncurses::Size textArea{};
 
 	ncurses::Point getScreenCursorPosition() const;
+	int getCursorColumn() const;
 
-	int getLineLength(std::string_view lineContents) const;
-	int getLineVirtualHeight(std::string_view lineContents) const;
+	static int getLineLength(Buffer::LineText lineContents);
+	static int visibleCharLengthAccumulate(int accumulator, char);
+	static int visibleUtf8CharLengthAccumulate(int accumulator, Utf8Char);
+	static std::vector<Frame::StyledSpan> styledSpans(std::string_view text, std::vector<Style> const& styles);
+	std::string getUnwrappedText(int line, std::vector<Style> const& lineStyles, std::vector<Style>& textStyles) const;
 
 	WindowInfo windowInfo{.topLine=0, .leftCol=0};
 	void adjustViewport();
 
+	FrameLayout layout;
+	void updateLayout();
+
 	bool wrap{true};
+	void setWrap(bool);
 	bool modified{false};
 
 	bool quit{false};
 
 	Buffer buffer;
+	ColumnIndex columnIndex{buffer};
+	HeightIndex heightIndex{buffer, columnIndex};
+	SyntaxIndex syntaxIndex{buffer};
+	std::optional<Journal> journal{};
+	ThreadPool threadPool{};
+	OffsetIndex offsetIndex{buffer, threadPool};
+	MarkIndex markIndex{buffer};
 	Register reg;
 	Mode mode{Mode::Normal};
 	ncurses::Key pendingOperator{ncurses::Key::Null};
@@ -114,6 +593,8 @@ private:
 	std::string cmdline;
 	int cmdlineCursor{0};
 
+	std::string message;
+
 	CursorPosition cursor{0, 0};
 };
 
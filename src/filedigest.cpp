@@ -0,0 +1,122 @@
+#include "filedigest.h"
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <string_view>
+
+#include <sys/stat.h>
+
+std::optional<FileStamp> FileStamp::of(std::filesystem::path const& path)
+{
+	struct stat status{};
+	if (::stat(path.c_str(), &status) != 0)
+	{
+		return std::nullopt;
+	}
+	return FileStamp{
+		.device=status.st_dev,
+		.inode=status.st_ino,
+		.size=status.st_size,
+		.modifiedNs=status.st_mtim.tv_sec * 1'000'000'000 + status.st_mtim.tv_nsec,
+	};
+}
+
+std::optional<FileDigest> FileDigest::of(std::filesystem::path const& path)
+{
+	auto file = std::ifstream(path, std::ios::binary);
+	if (not file)
+	{
+		return std::nullopt;
+	}
+
+	auto digest = FileDigest{};
+	auto data = std::string(maxBlockBytes, '\0');
+	auto partialLine = std::string{};
+	while (file)
+	{
+		file.read(data.data(), static_cast<std::streamsize>(data.size()));
+		auto chunk = std::string_view{data.data(), static_cast<std::size_t>(file.gcount())};
+		for (auto newline = chunk.find('\n'); newline != std::string_view::npos; newline = chunk.find('\n'))
+		{
+			if (partialLine.empty())
+			{
+				digest.addLine(chunk.substr(0, newline));
+			}
+			else
+			{
+				partialLine += chunk.substr(0, newline);
+				digest.addLine(partialLine);
+				partialLine.clear();
+			}
+			chunk.remove_prefix(newline + 1);
+		}
+		partialLine += chunk;
+	}
+	if (not partialLine.empty())
+	{
+		digest.addLine(partialLine, false);
+	}
+	digest.finish();
+	return digest;
+}
+
+void FileDigest::addLine(std::string_view line, bool hasNewline)
+{
+	auto lineHash = std::uint64_t{std::hash<std::string_view>{}(line)};
+	pending.hash = (pending.hash ^ lineHash) * 0x100000001b3;
+	pending.lines++;
+	pending.bytes += line.length() + (hasNewline ? 1 : 0);
+	if ((lineHash & boundaryMask) == boundaryMask || pending.bytes >= maxBlockBytes)
+	{
+		blocks.push_back(pending);
+		pending = {.hash=0, .lines=0, .bytes=0};
+	}
+}
+
+void FileDigest::finish()
+{
+	if (pending.lines > 0)
+	{
+		blocks.push_back(pending);
+		pending = {.hash=0, .lines=0, .bytes=0};
+	}
+}
+
+// Only the run of blocks between the longest common prefix and suffix counts
+// as changed.
+FileDigest::Difference FileDigest::compare(FileDigest const& newer) const
+{
+	auto& older = blocks;
+	auto& newBlocks = newer.blocks;
+	auto shorter = std::min(older.size(), newBlocks.size());
+
+	auto prefix = static_cast<std::size_t>(
+		std::mismatch(older.begin(), older.begin() + static_cast<std::ptrdiff_t>(shorter), newBlocks.begin()).first
+			- older.begin()
+	);
+	auto suffix = static_cast<std::size_t>(
+		std::mismatch(
+			older.rbegin(), older.rbegin() + static_cast<std::ptrdiff_t>(shorter - prefix), newBlocks.rbegin()
+		).first - older.rbegin()
+	);
+
+	auto difference = Difference{.line=0, .removed=0, .inserted=0, .offset=0, .length=0, .removedLength=0};
+	for (auto i = std::size_t{0}; i < prefix; i++)
+	{
+		difference.line += older[i].lines;
+		difference.offset += older[i].bytes;
+	}
+	for (auto i = prefix; i < older.size() - suffix; i++)
+	{
+		difference.removed += older[i].lines;
+		difference.removedLength += older[i].bytes;
+	}
+	for (auto i = prefix; i < newBlocks.size() - suffix; i++)
+	{
+		difference.inserted += newBlocks[i].lines;
+		difference.length += newBlocks[i].bytes;
+	}
+	return difference;
+}
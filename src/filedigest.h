@@ -0,0 +1,67 @@
+#ifndef SRC_FILEDIGEST_H_
+#define SRC_FILEDIGEST_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+// Enough of stat(2) to tell that a file was changed or replaced.
+struct FileStamp
+{
+	std::uint64_t device;
+	std::uint64_t inode;
+	std::int64_t size;
+	std::int64_t modifiedNs;
+
+	bool operator==(FileStamp const&) const = default;
+
+	static std::optional<FileStamp> of(std::filesystem::path const&);
+};
+
+// Hashes of a file in blocks of whole lines.  A block ends after a line whose
+// own hash says so, rather than after a fixed number of bytes, so an edit only
+// changes the blocks around it and the blocks after it line up again.
+class FileDigest
+{
+public:
+	static std::optional<FileDigest> of(std::filesystem::path const&);
+
+	// Builds a digest of text already at hand, a line at a time; finish ends
+	// the last block.
+	void addLine(std::string_view line, bool hasNewline = true);
+	void finish();
+
+	// Lines [line, line + removed), the removedLength bytes at `offset` of the
+	// older version, were replaced by the `inserted` lines at
+	// [offset, offset + length) of the newer one.
+	struct Difference
+	{
+		int line;
+		int removed;
+		int inserted;
+		std::size_t offset;
+		std::size_t length;
+		std::size_t removedLength;
+	};
+	Difference compare(FileDigest const& newer) const;
+
+private:
+	struct Block
+	{
+		std::uint64_t hash;
+		int lines;
+		std::size_t bytes;
+
+		bool operator==(Block const&) const = default;
+	};
+	std::vector<Block> blocks{};
+	Block pending{.hash=0, .lines=0, .bytes=0};
+
+	static constexpr auto boundaryMask = std::uint64_t{63};  // about 64 lines a block
+	static constexpr auto maxBlockBytes = std::size_t{1} << 20;
+};
+
+#endif // SRC_FILEDIGEST_H_
@@ -0,0 +1,218 @@
+#include "filter.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <string_view>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+void closePipes(std::array<int, 6>& fds)
+{
+	for (auto& fd: fds)
+	{
+		if (fd >= 0)
+		{
+			::close(fd);
+			fd = -1;
+		}
+	}
+}
+
+// Starts the shell with its standard streams on the child ends of the pipes,
+// which are closed here once it has them.
+pid_t spawnShell(std::string const& command, std::array<int, 6>& pipes, std::string& error)
+{
+	auto actions = posix_spawn_file_actions_t{};
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, pipes[0], STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, pipes[3], STDOUT_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, pipes[5], STDERR_FILENO);
+
+	// the editor's threads may have signals blocked; the command gets none
+	auto attributes = posix_spawnattr_t{};
+	posix_spawnattr_init(&attributes);
+	auto noSignals = sigset_t{};
+	sigemptyset(&noSignals);
+	posix_spawnattr_setsigmask(&attributes, &noSignals);
+	posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK);
+
+	auto pid = pid_t{-1};
+	char const* arguments[] = {"sh", "-c", command.c_str(), nullptr};
+	auto result = posix_spawn(&pid, "/bin/sh", &actions, &attributes, const_cast<char* const*>(arguments), environ);
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attributes);
+
+	for (auto end: {0, 3, 5})
+	{
+		::close(pipes[static_cast<std::size_t>(end)]);
+		pipes[static_cast<std::size_t>(end)] = -1;
+	}
+	if (result != 0)
+	{
+		error = std::strerror(result);
+		return -1;
+	}
+	return pid;
+}
+
+// A command that quits before reading all its input would have writing to it
+// raise SIGPIPE, so that is blocked while feeding it, and any raised is taken
+// off again before it is unblocked.
+std::optional<std::vector<std::string>> runFilter(
+	std::string const& command, std::function<bool(std::string&)> const& fill, std::string& error)
+{
+	auto pipes = std::array<int, 6>{-1, -1, -1, -1, -1, -1};
+	for (auto i = std::size_t{0}; i < pipes.size(); i += 2)
+	{
+		if (pipe2(&pipes[i], O_CLOEXEC) != 0)
+		{
+			error = std::strerror(errno);
+			closePipes(pipes);
+			return std::nullopt;
+		}
+	}
+	auto pid = spawnShell(command, pipes, error);
+	if (pid < 0)
+	{
+		closePipes(pipes);
+		return std::nullopt;
+	}
+	auto& input = pipes[1];
+	auto& output = pipes[2];
+	auto& errors = pipes[4];
+	fcntl(input, F_SETFL, O_NONBLOCK);
+
+	auto sigpipe = sigset_t{};
+	sigemptyset(&sigpipe);
+	sigaddset(&sigpipe, SIGPIPE);
+	auto previousMask = sigset_t{};
+	pthread_sigmask(SIG_BLOCK, &sigpipe, &previousMask);
+
+	constexpr auto maxErrorText = std::size_t{200};
+	auto lines = std::vector<std::string>{};
+	auto partialLine = std::string{};
+	auto errorText = std::string{};
+	auto pending = std::string{};
+	auto written = std::size_t{0};
+	auto moreInput = true;
+	auto buffer = std::array<char, 1 << 16>{};
+	while (input >= 0 || output >= 0 || errors >= 0)
+	{
+		if (input >= 0 && written == pending.length())
+		{
+			pending.clear();
+			written = 0;
+			if (moreInput)
+			{
+				moreInput = fill(pending);
+			}
+			if (pending.empty() && not moreInput)
+			{
+				::close(input);
+				input = -1;
+			}
+		}
+
+		auto polled = std::array<pollfd, 3>{{
+			{.fd=input, .events=POLLOUT, .revents=0},
+			{.fd=output, .events=POLLIN, .revents=0},
+			{.fd=errors, .events=POLLIN, .revents=0},
+		}};
+		if (poll(polled.data(), polled.size(), -1) < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			break;
+		}
+
+		if (polled[0].revents != 0)
+		{
+			auto n = ::write(input, pending.data() + written, pending.length() - written);
+			if (n >= 0)
+			{
+				written += static_cast<std::size_t>(n);
+			}
+			else if (errno != EAGAIN && errno != EINTR)  // EPIPE: the command read no further
+			{
+				::close(input);
+				input = -1;
+			}
+		}
+		if (polled[1].revents != 0)
+		{
+			auto n = ::read(output, buffer.data(), buffer.size());
+			if (n > 0)
+			{
+				auto text = std::string_view{buffer.data(), static_cast<std::size_t>(n)};
+				for (auto end = text.find('\n'); end != std::string_view::npos; end = text.find('\n'))
+				{
+					partialLine += text.substr(0, end);
+					lines.push_back(std::move(partialLine));
+					partialLine.clear();
+					text.remove_prefix(end + 1);
+				}
+				partialLine += text;
+			}
+			else if (n == 0 || errno != EINTR)
+			{
+				::close(output);
+				output = -1;
+			}
+		}
+		if (polled[2].revents != 0)
+		{
+			auto n = ::read(errors, buffer.data(), buffer.size());
+			if (n > 0)
+			{
+				auto room = maxErrorText - std::min(maxErrorText, errorText.length());
+				errorText.append(buffer.data(), std::min(room, static_cast<std::size_t>(n)));
+			}
+			else if (n == 0 || errno != EINTR)
+			{
+				::close(errors);
+				errors = -1;
+			}
+		}
+	}
+	closePipes(pipes);
+
+	auto status = 0;
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+	{
+	}
+	auto noWait = timespec{.tv_sec=0, .tv_nsec=0};
+	while (sigtimedwait(&sigpipe, nullptr, &noWait) > 0)
+	{
+	}
+	pthread_sigmask(SIG_SETMASK, &previousMask, nullptr);
+
+	if (not WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+		error = WIFEXITED(status)
+			? "`" + command + "' exited with status " + std::to_string(WEXITSTATUS(status))
+			: "`" + command + "' was killed by signal " + std::to_string(WTERMSIG(status));
+		if (auto firstLine = errorText.substr(0, errorText.find('\n')); not firstLine.empty())
+		{
+			error += ": " + firstLine;
+		}
+		return std::nullopt;
+	}
+	if (not partialLine.empty())
+	{
+		lines.push_back(std::move(partialLine));
+	}
+	return lines;
+}
@@ -0,0 +1,19 @@
+#ifndef SRC_FILTER_H_
+#define SRC_FILTER_H_
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Runs `command` with the shell, writing what `fill` gives to its standard
+// input while reading its standard output as lines; fill appends the next
+// piece of the input to its argument and returns false along with the last
+// one.  Both sides are served as they turn ready, so neither waits on the
+// other however much either has to say.  The output is only given if the
+// command exits with 0; otherwise `error` says why, with the start of what
+// the command printed to its standard error.
+[[nodiscard]] std::optional<std::vector<std::string>> runFilter(
+	std::string const& command, std::function<bool(std::string&)> const& fill, std::string& error);
+
+#endif // SRC_FILTER_H_
@@ -0,0 +1,119 @@
+#include "follower.h"
+
+#include <array>
+#include <cstring>
+#include <string_view>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+Follower::Follower(std::filesystem::path const& path, off_t from)
+	: notifyFd{inotify_init1(IN_NONBLOCK | IN_CLOEXEC)}
+	, fileFd{::open(path.c_str(), O_RDONLY | O_CLOEXEC)}
+{
+	struct stat status{};
+	if (
+		notifyFd < 0 || fileFd < 0
+		|| inotify_add_watch(notifyFd, path.c_str(), IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF) < 0
+		|| fstat(fileFd, &status) != 0
+	)
+	{
+		if (notifyFd >= 0)
+		{
+			::close(notifyFd);
+			notifyFd = -1;
+		}
+		return;
+	}
+	offset = from;
+	hasUnread = status.st_size != offset;
+	if (auto last = char{}; offset > 0 && pread(fileFd, &last, 1, offset - 1) == 1)
+	{
+		continuesLine = last != '\n';
+	}
+}
+
+Follower::~Follower()
+{
+	if (notifyFd >= 0)
+	{
+		::close(notifyFd);
+	}
+	if (fileFd >= 0)
+	{
+		::close(fileFd);
+	}
+}
+
+bool Follower::isOpen() const
+{
+	return notifyFd >= 0;
+}
+
+int Follower::fd() const
+{
+	return notifyFd;
+}
+
+Follower::Update Follower::readUpdate()
+{
+	auto update = Update{};
+
+	auto changed = std::exchange(hasUnread, false);
+	auto events = std::array<char, 4096>{};
+	for (auto n = ::read(notifyFd, events.data(), events.size()); n > 0; n = ::read(notifyFd, events.data(), events.size()))
+	{
+		changed = true;
+		for (auto p = events.data(); p < events.data() + n; )
+		{
+			auto event = inotify_event{};
+			std::memcpy(&event, p, sizeof(event));
+			if (event.mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED))
+			{
+				update.gone = true;
+			}
+			p += sizeof(event) + event.len;
+		}
+	}
+	if (not changed)
+	{
+		return update;
+	}
+
+	struct stat status{};
+	if (fstat(fileFd, &status) != 0)
+	{
+		return update;
+	}
+	if (status.st_nlink == 0)  // unlinked, but kept alive by our descriptor
+	{
+		update.gone = true;
+	}
+	if (status.st_size < offset)
+	{
+		update.truncated = true;
+		offset = 0;
+		partialLine.clear();
+		continuesLine = false;
+	}
+
+	auto block = std::array<char, 1 << 16>{};
+	for (auto n = pread(fileFd, block.data(), block.size(), offset); n > 0; n = pread(fileFd, block.data(), block.size(), offset))
+	{
+		offset += n;
+		auto data = std::string_view{block.data(), static_cast<std::size_t>(n)};
+		for (auto newline = data.find('\n'); newline != std::string_view::npos; newline = data.find('\n'))
+		{
+			partialLine += data.substr(0, newline);
+			update.continuesLastLine |= std::exchange(continuesLine, false);
+			update.lines.push_back(std::move(partialLine));
+			partialLine.clear();
+			data.remove_prefix(newline + 1);
+		}
+		partialLine += data;
+	}
+	return update;
+}
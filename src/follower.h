@@ -0,0 +1,42 @@
+#ifndef SRC_FOLLOWER_H_
+#define SRC_FOLLOWER_H_
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+// Watches a file with inotify and reads what was appended to it since it was
+// last asked, starting from the offset it is given: where the file ended when
+// its lines were last read.  What is before it is never read again.
+class Follower
+{
+public:
+	Follower(std::filesystem::path const&, off_t from);
+	~Follower();
+	Follower(Follower const&) = delete;
+	Follower& operator=(Follower const&) = delete;
+
+	bool isOpen() const;
+	int fd() const;  // readable once the file may have changed
+
+	struct Update
+	{
+		std::vector<std::string> lines{};  // complete lines only
+		bool continuesLastLine{false};  // the first goes on the end of the line before `from`
+		bool truncated{false};  // read again from the start
+		bool gone{false};  // the file was deleted or moved away
+	};
+	Update readUpdate();
+
+private:
+	int notifyFd{-1};
+	int fileFd{-1};
+	off_t offset{0};
+	std::string partialLine{};
+	bool hasUnread{false};  // the file grew before it was watched
+	bool continuesLine{false};  // `from` was not at the start of a line
+};
+
+#endif // SRC_FOLLOWER_H_
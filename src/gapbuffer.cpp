@@ -0,0 +1,81 @@
+#include "gapbuffer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+GapBuffer::GapBuffer(std::string text)
+	: storage{std::move(text)}
+	, gapStart{storage.length()}
+	, gapEnd{storage.length()}
+{
+}
+
+void GapBuffer::insert(std::size_t pos, char ch, std::size_t count)
+{
+	assert(pos <= length());
+	moveGap(pos);
+	if (gapEnd - gapStart < count)
+	{
+		growGap(count);
+	}
+	std::fill_n(storage.begin() + static_cast<std::ptrdiff_t>(gapStart), count, ch);
+	gapStart += count;
+}
+
+void GapBuffer::erase(std::size_t pos, std::size_t count)
+{
+	assert(pos <= length());
+	count = std::min(count, length() - pos);
+	moveGap(pos);
+	gapEnd += count;
+}
+
+std::size_t GapBuffer::length() const
+{
+	return storage.length() - (gapEnd - gapStart);
+}
+
+std::string_view GapBuffer::beforeGap() const
+{
+	return std::string_view{storage}.substr(0, gapStart);
+}
+
+std::string_view GapBuffer::afterGap() const
+{
+	return std::string_view{storage}.substr(gapEnd);
+}
+
+std::string GapBuffer::release() &&
+{
+	moveGap(length());
+	storage.resize(gapStart);
+	return std::move(storage);
+}
+
+void GapBuffer::moveGap(std::size_t pos)
+{
+	if (pos < gapStart)
+	{
+		auto distance = gapStart - pos;
+		std::memmove(storage.data() + gapEnd - distance, storage.data() + pos, distance);
+		gapStart -= distance;
+		gapEnd -= distance;
+	}
+	else if (pos > gapStart)
+	{
+		auto distance = pos - gapStart;
+		std::memmove(storage.data() + gapStart, storage.data() + gapEnd, distance);
+		gapStart += distance;
+		gapEnd += distance;
+	}
+}
+
+void GapBuffer::growGap(std::size_t minimum)
+{
+	auto tailLength = storage.length() - gapEnd;
+	auto newGap = std::max({minimum, storage.length(), std::size_t{64}});
+	storage.resize(storage.length() + newGap);
+	std::memmove(storage.data() + storage.length() - tailLength, storage.data() + gapEnd, tailLength);
+	gapEnd = storage.length() - tailLength;
+}
@@ -0,0 +1,35 @@
+#ifndef SRC_GAPBUFFER_H_
+#define SRC_GAPBUFFER_H_
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// A line of text with a movable gap at the editing position.  Inserting or
+// erasing at the gap is O(1) amortised; moving the gap costs the distance moved.
+class GapBuffer
+{
+public:
+	explicit GapBuffer(std::string text);
+
+	void insert(std::size_t pos, char, std::size_t count);
+	void erase(std::size_t pos, std::size_t count);
+
+	std::size_t length() const;
+
+	std::string_view beforeGap() const;
+	std::string_view afterGap() const;
+
+	// Closes the gap and hands the contiguous text back.
+	std::string release() &&;
+
+private:
+	void moveGap(std::size_t pos);
+	void growGap(std::size_t minimum);
+
+	std::string storage;
+	std::size_t gapStart;
+	std::size_t gapEnd;
+};
+
+#endif // SRC_GAPBUFFER_H_
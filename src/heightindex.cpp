@@ -0,0 +1,76 @@
+#include "editor.h"
+
+#include <cassert>
+
+int ceilingDivide(int divident, int divisor)
+{
+	auto quotient = divident / divisor;
+	auto remainder = divident % divisor;
+	return quotient + (remainder ? 1 : 0);
+}
+
+Editor::HeightIndex::HeightIndex(Buffer& b, ColumnIndex const& c)
+	: buffer{b}
+	, columnIndex{c}
+{
+	buffer.attach(this);
+}
+
+Editor::HeightIndex::~HeightIndex()
+{
+	buffer.detach(this);
+}
+
+void Editor::HeightIndex::setWrapWidth(int width)
+{
+	assert(width >= 0);
+	wrapWidth = width;
+}
+
+int Editor::HeightIndex::height(int line) const
+{
+	if (wrapWidth == 0)
+	{
+		return 1;
+	}
+	return std::max(1, ceilingDivide(lineWidth(line), wrapWidth));
+}
+
+// Lines that moved are forgotten rather than renumbered; only the lines on
+// screen get measured again.
+void Editor::HeightIndex::linesChanged(int line, int removed, int inserted)
+{
+	assert(line >= 0 && removed >= 0 && inserted >= 0);
+	if (removed == inserted)
+	{
+		for (auto i = line; i < line + removed; i++)
+		{
+			widths.erase(i);
+		}
+	}
+	else
+	{
+		std::erase_if(widths, [line](auto const& entry) { return entry.first >= line; });
+	}
+}
+
+void Editor::HeightIndex::linesDeleted(int line, std::span<std::uint8_t const>)
+{
+	std::erase_if(widths, [line](auto const& entry) { return entry.first >= line; });
+}
+
+int Editor::HeightIndex::lineWidth(int line) const
+{
+	assert(line >= 0);
+	if (auto it = widths.find(line); it != widths.end())
+	{
+		return it->second;
+	}
+	if (widths.size() >= maxCachedLines)
+	{
+		widths.clear();
+	}
+	auto width = columnIndex.width(line);
+	widths.emplace(line, width);
+	return width;
+}
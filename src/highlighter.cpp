@@ -0,0 +1,400 @@
+#include "highlighter.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cctype>
+
+Syntax syntaxFor(std::filesystem::path const& path)
+{
+	auto extension = path.extension().string();
+	if (extension == ".gz" || extension == ".zst")
+	{
+		extension = path.stem().extension().string();
+	}
+
+	constexpr auto cppExtensions = std::array<std::string_view, 9>{
+		".c", ".cc", ".cpp", ".cxx", ".h", ".hh", ".hpp", ".hxx", ".ipp"
+	};
+	if (std::find(cppExtensions.begin(), cppExtensions.end(), extension) != cppExtensions.end())
+	{
+		return Syntax::Cpp;
+	}
+	if (extension == ".json")
+	{
+		return Syntax::Json;
+	}
+	if (extension == ".log")
+	{
+		return Syntax::Log;
+	}
+	return Syntax::None;
+}
+
+LexText::LexText(std::string_view h, std::string_view t)
+	: head{h}, tail{t}
+{
+}
+
+LexText LexText::prefix(std::size_t count) const
+{
+	if (count <= head.length())
+	{
+		return {head.substr(0, count)};
+	}
+	return {head, tail.substr(0, count - head.length())};
+}
+
+bool LexText::startsWith(std::size_t pos, std::string_view text) const
+{
+	if (pos > length() || length() - pos < text.length())
+	{
+		return false;
+	}
+	for (auto k = std::size_t{0}; k < text.length(); k++)
+	{
+		if ((*this)[pos + k] != text[k])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Within the head, then across the join, then within the tail.
+std::size_t LexText::find(std::string_view text, std::size_t pos) const
+{
+	if (pos < head.length())
+	{
+		if (auto found = head.find(text, pos); found != std::string_view::npos)
+		{
+			return found;
+		}
+	}
+	assert(not text.empty());
+	auto across = std::max(pos, head.length() - std::min(head.length(), text.length() - 1));
+	for (; across < head.length(); across++)
+	{
+		if (startsWith(across, text))
+		{
+			return across;
+		}
+	}
+	auto found = tail.find(text, std::max(pos, head.length()) - head.length());
+	return found == std::string_view::npos ? found : head.length() + found;
+}
+
+std::size_t LexText::findFirstNotOf(std::string_view chars, std::size_t pos) const
+{
+	if (pos < head.length())
+	{
+		if (auto found = head.find_first_not_of(chars, pos); found != std::string_view::npos)
+		{
+			return found;
+		}
+	}
+	auto found = tail.find_first_not_of(chars, std::max(pos, head.length()) - head.length());
+	return found == std::string_view::npos ? found : head.length() + found;
+}
+
+std::size_t LexText::findLastNotOf(char c, std::size_t pos) const
+{
+	if (pos >= head.length() && not tail.empty())
+	{
+		if (auto found = tail.find_last_not_of(c, pos - head.length()); found != std::string_view::npos)
+		{
+			return head.length() + found;
+		}
+	}
+	return head.find_last_not_of(c, pos);
+}
+
+std::string_view LexText::slice(std::size_t from, std::size_t to, std::string& scratch) const
+{
+	if (to <= head.length())
+	{
+		return head.substr(from, to - from);
+	}
+	if (from >= head.length())
+	{
+		return tail.substr(from - head.length(), to - from);
+	}
+	scratch.assign(head.substr(from));
+	scratch.append(tail.substr(0, to - head.length()));
+	return scratch;
+}
+
+bool isIdentifierChar(char c)
+{
+	return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+std::size_t identifierEnd(LexText line, std::size_t from)
+{
+	while (from < line.length() && isIdentifierChar(line[from]))
+	{
+		from++;
+	}
+	return from;
+}
+
+// Past the closing quote, or at the end of the line if there is none; a
+// backslash escapes the character after it.
+std::size_t quotedEnd(LexText line, std::size_t from, char quote)
+{
+	for (; from < line.length(); from++)
+	{
+		if (line[from] == '\\')
+		{
+			from++;
+		}
+		else if (line[from] == quote)
+		{
+			return from + 1;
+		}
+	}
+	return line.length();
+}
+
+// Digits, letters for suffixes and hexadecimal, digit separators, points and
+// signed exponents.
+std::size_t numberEnd(LexText line, std::size_t from)
+{
+	for (; from < line.length(); from++)
+	{
+		auto c = line[from];
+		auto isExponentSign = (c == '+' || c == '-') && from > 0
+			&& (line[from - 1] == 'e' || line[from - 1] == 'E' || line[from - 1] == 'p' || line[from - 1] == 'P');
+		if (not isIdentifierChar(c) && c != '.' && c != '\'' && not isExponentSign)
+		{
+			break;
+		}
+	}
+	return from;
+}
+
+void addToken(std::vector<Token>* tokens, std::size_t from, std::size_t to, Style style)
+{
+	if (tokens != nullptr && to > from)
+	{
+		tokens->push_back({.offset=from, .length=to - from, .style=style});
+	}
+}
+
+constexpr auto cppKeywords = std::array<std::string_view, 62>{
+	"alignas", "alignof", "asm", "break", "case", "catch", "class", "co_await", "co_return", "co_yield",
+	"concept", "const", "const_cast", "consteval", "constexpr", "constinit", "continue", "decltype", "default",
+	"delete", "do", "dynamic_cast", "else", "enum", "explicit", "export", "extern", "false", "final", "for",
+	"friend", "goto", "if", "inline", "mutable", "namespace", "new", "noexcept", "nullptr", "operator",
+	"override", "private", "protected", "public", "reinterpret_cast", "requires", "return", "sizeof", "static",
+	"static_assert", "static_cast", "struct", "switch", "template", "this", "throw", "true", "try", "typedef",
+	"typename", "using", "while",
+};
+constexpr auto cppTypes = std::array<std::string_view, 18>{
+	"auto", "bool", "char", "char16_t", "char32_t", "char8_t", "double", "float", "int", "long", "short",
+	"signed", "size_t", "std", "union", "unsigned", "virtual", "void",
+};
+
+enum CppState: LexState
+{
+	CppCode = initialLexState, CppBlockComment, CppRawString, CppStringContinued
+};
+
+LexState lexCpp(LexState state, LexText line, std::vector<Token>* tokens)
+{
+	auto scratch = std::string{};
+	auto i = std::size_t{0};
+	if (state == CppBlockComment || state == CppRawString)
+	{
+		auto close = line.find(state == CppBlockComment ? "*/" : ")\"", 0);
+		auto end = close == std::string_view::npos ? line.length() : close + 2;
+		addToken(tokens, 0, end, state == CppBlockComment ? Style::Comment : Style::String);
+		if (close == std::string_view::npos)
+		{
+			return state;
+		}
+		i = end;
+	}
+	else if (state == CppStringContinued)
+	{
+		i = quotedEnd(line, 0, '"');
+		addToken(tokens, 0, i, Style::String);
+		if (i == line.length() && line.endsWith('\\'))
+		{
+			return CppStringContinued;
+		}
+	}
+
+	auto firstNonBlank = line.findFirstNotOf(" \t", 0);
+	while (i < line.length())
+	{
+		auto c = line[i];
+		if (line.startsWith(i, "//"))
+		{
+			addToken(tokens, i, line.length(), Style::Comment);
+			return CppCode;
+		}
+		if (line.startsWith(i, "/*"))
+		{
+			auto close = line.find("*/", i + 2);
+			auto end = close == std::string_view::npos ? line.length() : close + 2;
+			addToken(tokens, i, end, Style::Comment);
+			if (close == std::string_view::npos)
+			{
+				return CppBlockComment;
+			}
+			i = end;
+		}
+		else if (line.startsWith(i, "R\"("))
+		{
+			auto close = line.find(")\"", i + 3);
+			auto end = close == std::string_view::npos ? line.length() : close + 2;
+			addToken(tokens, i, end, Style::String);
+			if (close == std::string_view::npos)
+			{
+				return CppRawString;
+			}
+			i = end;
+		}
+		else if (c == '"' || c == '\'')
+		{
+			auto end = quotedEnd(line, i + 1, c);
+			addToken(tokens, i, end, Style::String);
+			if (c == '"' && end == line.length() && line.endsWith('\\'))
+			{
+				return CppStringContinued;
+			}
+			i = end;
+		}
+		else if (c == '#' && i == firstNonBlank)
+		{
+			auto end = identifierEnd(line, std::min(line.findFirstNotOf(" \t", i + 1), line.length()));
+			addToken(tokens, i, end, Style::Preprocessor);
+			i = end;
+		}
+		else if (std::isdigit(static_cast<unsigned char>(c))
+			|| (c == '.' && i + 1 < line.length() && std::isdigit(static_cast<unsigned char>(line[i + 1]))))
+		{
+			auto end = numberEnd(line, i);
+			addToken(tokens, i, end, Style::Number);
+			i = end;
+		}
+		else if (isIdentifierChar(c))
+		{
+			auto end = identifierEnd(line, i);
+			auto word = line.slice(i, end, scratch);
+			if (std::find(cppKeywords.begin(), cppKeywords.end(), word) != cppKeywords.end())
+			{
+				addToken(tokens, i, end, Style::Keyword);
+			}
+			else if (std::find(cppTypes.begin(), cppTypes.end(), word) != cppTypes.end())
+			{
+				addToken(tokens, i, end, Style::Type);
+			}
+			i = end;
+		}
+		else
+		{
+			i++;
+		}
+	}
+	return CppCode;
+}
+
+// JSON strings cannot span lines, so every line starts afresh.  Keys are told
+// from other strings by the colon after them.
+LexState lexJson(LexText line, std::vector<Token>* tokens)
+{
+	auto scratch = std::string{};
+	for (auto i = std::size_t{0}; i < line.length(); )
+	{
+		auto c = line[i];
+		if (c == '"')
+		{
+			auto end = quotedEnd(line, i + 1, '"');
+			auto next = line.findFirstNotOf(" \t", end);
+			auto isKey = next != std::string_view::npos && line[next] == ':';
+			addToken(tokens, i, end, isKey ? Style::Keyword : Style::String);
+			i = end;
+		}
+		else if (c == '-' || std::isdigit(static_cast<unsigned char>(c)))
+		{
+			auto end = numberEnd(line, i + 1);
+			addToken(tokens, i, end, Style::Number);
+			i = end;
+		}
+		else if (std::isalpha(static_cast<unsigned char>(c)))
+		{
+			auto end = identifierEnd(line, i);
+			if (auto word = line.slice(i, end, scratch); word == "true" || word == "false" || word == "null")
+			{
+				addToken(tokens, i, end, Style::Number);
+			}
+			i = end;
+		}
+		else
+		{
+			i++;
+		}
+	}
+	return initialLexState;
+}
+
+struct LevelWord
+{
+	std::string_view word;
+	Style style;
+};
+constexpr auto logLevels = std::array<LevelWord, 16>{{
+	{"FATAL", Style::Error}, {"CRITICAL", Style::Error}, {"ERROR", Style::Error}, {"ERR", Style::Error},
+	{"Fatal", Style::Error}, {"Error", Style::Error},
+	{"WARNING", Style::Warning}, {"WARN", Style::Warning}, {"Warning", Style::Warning},
+	{"INFO", Style::Info}, {"NOTICE", Style::Info}, {"Info", Style::Info},
+	{"DEBUG", Style::Debug}, {"TRACE", Style::Debug}, {"Debug", Style::Debug}, {"Trace", Style::Debug},
+}};
+
+// A timestamp leading the line is dimmed, and level words stand out.
+LexState lexLog(LexText line, std::vector<Token>* tokens)
+{
+	auto scratch = std::string{};
+	auto i = std::size_t{0};
+	if (not line.empty() && std::isdigit(static_cast<unsigned char>(line[0])))
+	{
+		i = std::min(line.findFirstNotOf("0123456789-:.,/TZ+ ", 0), line.length());
+		auto end = line.findLastNotOf(' ', i - 1) + 1;
+		addToken(tokens, 0, end, Style::Comment);
+	}
+	while (i < line.length())
+	{
+		if (not std::isalpha(static_cast<unsigned char>(line[i])))
+		{
+			i++;
+			continue;
+		}
+		auto end = identifierEnd(line, i);
+		auto word = line.slice(i, end, scratch);
+		auto isLevel = [word](LevelWord const& level) { return level.word == word; };
+		if (auto level = std::find_if(logLevels.begin(), logLevels.end(), isLevel); level != logLevels.end())
+		{
+			addToken(tokens, i, end, level->style);
+		}
+		i = end;
+	}
+	return initialLexState;
+}
+
+LexState lexLine(Syntax syntax, LexState state, LexText line, std::vector<Token>* tokens)
+{
+	switch (syntax)
+	{
+		case Syntax::Cpp:
+			return lexCpp(state, line, tokens);
+		case Syntax::Json:
+			return lexJson(line, tokens);
+		case Syntax::Log:
+			return lexLog(line, tokens);
+		case Syntax::None:
+			break;
+	}
+	return initialLexState;
+}
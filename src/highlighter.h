@@ -0,0 +1,68 @@
+#ifndef SRC_HIGHLIGHTER_H_
+#define SRC_HIGHLIGHTER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class Syntax
+{
+	None, Cpp, Json, Log
+};
+
+// Goes by the file's extension, looking past a .gz or .zst.
+Syntax syntaxFor(std::filesystem::path const&);
+
+enum class Style: std::uint8_t
+{
+	Plain, Keyword, Type, String, Number, Comment, Preprocessor, Error, Warning, Info, Debug
+};
+
+struct Token
+{
+	std::size_t offset;
+	std::size_t length;
+	Style style;
+};
+
+// What a line leaves open for the next one, such as a block comment; lines
+// are lexed one at a time, each starting in the state the one before it ended
+// in.  The first line starts in initialLexState.
+using LexState = std::uint8_t;
+constexpr auto initialLexState = LexState{0};
+
+// A line to lex, which may come in two pieces, as the line being typed in
+// does, so that it need not be joined first.
+class LexText
+{
+public:
+	LexText(std::string_view head, std::string_view tail = {});
+
+	std::size_t length() const { return head.length() + tail.length(); }
+	bool empty() const { return length() == 0; }
+	char operator[](std::size_t i) const { return i < head.length() ? head[i] : tail[i - head.length()]; }
+	bool endsWith(char c) const { return not empty() && (*this)[length() - 1] == c; }
+
+	// The first `count` bytes.
+	LexText prefix(std::size_t count) const;
+	bool startsWith(std::size_t pos, std::string_view text) const;
+	// Like std::string_view's; npos if there is none.
+	std::size_t find(std::string_view text, std::size_t pos) const;
+	std::size_t findFirstNotOf(std::string_view chars, std::size_t pos) const;
+	std::size_t findLastNotOf(char c, std::size_t pos) const;
+	// Bytes [from, to), copied into `scratch` only if they span both pieces.
+	std::string_view slice(std::size_t from, std::size_t to, std::string& scratch) const;
+
+private:
+	std::string_view head;
+	std::string_view tail;
+};
+
+// Returns the state the next line starts in; the tokens, other than plain
+// text, are appended to `tokens` unless it is null.
+LexState lexLine(Syntax, LexState, LexText line, std::vector<Token>* tokens);
+
+#endif // SRC_HIGHLIGHTER_H_
@@ -0,0 +1,383 @@
+#include "editor.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// A swap file starts with a header naming the state of the file the changes
+// apply to.  Every record after it is a splice of lines: its length, a CRC-32
+// of its payload, then the line, the number of lines removed and inserted,
+// and the length and text of each inserted line.  Numbers are 32 bits wide,
+// in the byte order of the machine that wrote them.
+
+constexpr auto swapMagic = std::array<char, 8>{'V', 'E', 'D', 'S', 'W', 'A', 'P', '1'};
+constexpr auto headerSize = swapMagic.size() + 4 * sizeof(std::uint64_t) + sizeof(std::uint32_t);
+
+void appendNumber(std::string& out, std::uint32_t n)
+{
+	auto bytes = std::array<char, sizeof n>{};
+	std::memcpy(bytes.data(), &n, sizeof n);
+	out.append(bytes.data(), bytes.size());
+}
+
+void appendNumber64(std::string& out, std::uint64_t n)
+{
+	auto bytes = std::array<char, sizeof n>{};
+	std::memcpy(bytes.data(), &n, sizeof n);
+	out.append(bytes.data(), bytes.size());
+}
+
+std::uint32_t checksum(std::string_view data)
+{
+	return static_cast<std::uint32_t>(
+		crc32(0, reinterpret_cast<Bytef const*>(data.data()), static_cast<uInt>(data.size())));
+}
+
+std::string makeHeader(std::optional<FileStamp> base)
+{
+	auto stamp = base.value_or(FileStamp{.device=0, .inode=0, .size=0, .modifiedNs=0});
+	auto header = std::string(swapMagic.data(), swapMagic.size());
+	appendNumber64(header, stamp.device);
+	appendNumber64(header, stamp.inode);
+	appendNumber64(header, static_cast<std::uint64_t>(stamp.size));
+	appendNumber64(header, static_cast<std::uint64_t>(stamp.modifiedNs));
+	appendNumber(header, checksum(header));
+	return header;
+}
+
+bool writeJournal(int fd, std::string_view data)
+{
+	while (not data.empty())
+	{
+		auto n = ::write(fd, data.data(), data.size());
+		if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (n <= 0)
+		{
+			return false;
+		}
+		data.remove_prefix(static_cast<std::size_t>(n));
+	}
+	return true;
+}
+
+// Creates the swap file, refusing to take over one that is already there.
+Editor::Journal::Journal(Buffer& b, std::filesystem::path const& path, std::optional<FileStamp> base)
+	: buffer{b}
+	, swapPath{path}
+	, fd{::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600)}
+{
+	if (fd < 0 || not writeJournal(fd, makeHeader(base)) || fdatasync(fd) != 0)
+	{
+		if (fd >= 0)
+		{
+			::close(fd);
+			::unlink(swapPath.c_str());
+			fd = -1;
+		}
+		return;
+	}
+	buffer.attach(this);
+	thread = std::jthread{[this](std::stop_token stopToken) { run(stopToken); }};
+}
+
+// Goes on appending to a swap file just replayed, dropping whatever was found
+// torn at its end.
+Editor::Journal::Journal(Buffer& b, std::filesystem::path const& path, off_t resumeAt)
+	: buffer{b}
+	, swapPath{path}
+	, fd{::open(path.c_str(), O_WRONLY | O_CLOEXEC)}
+{
+	if (fd < 0 || ftruncate(fd, resumeAt) != 0 || lseek(fd, 0, SEEK_END) < 0)
+	{
+		if (fd >= 0)
+		{
+			::close(fd);
+			fd = -1;
+		}
+		return;
+	}
+	buffer.attach(this);
+	thread = std::jthread{[this](std::stop_token stopToken) { run(stopToken); }};
+}
+
+// The swap file is left behind with every change recorded so far, for ved -r
+// to replay; it goes only when the changes are saved or thrown away.
+Editor::Journal::~Journal()
+{
+	if (fd < 0)
+	{
+		return;
+	}
+	flushDeferred();
+	stop();
+	if (writeJournal(fd, pending))
+	{
+		fdatasync(fd);
+	}
+	::close(fd);
+}
+
+void Editor::Journal::discard()
+{
+	if (fd < 0)
+	{
+		return;
+	}
+	stop();
+	::close(fd);
+	::unlink(swapPath.c_str());
+	fd = -1;
+}
+
+// Whatever the thread had not written yet is left in pending.
+void Editor::Journal::stop()
+{
+	buffer.detach(this);
+	thread.request_stop();
+	thread.join();
+}
+
+bool Editor::Journal::isOpen() const
+{
+	return fd >= 0;
+}
+
+std::filesystem::path Editor::Journal::swapPathFor(std::filesystem::path const& path)
+{
+	return path.parent_path() / ("." + path.filename().string() + ".swp");
+}
+
+void Editor::Journal::setPaused(bool pause)
+{
+	if (pause)
+	{
+		flushDeferred();
+	}
+	paused = pause;
+}
+
+// A change within a single line, as each key typed makes, is not recorded
+// straight away: the line is recorded as it then is once a change to another
+// line comes in or the first change is commitInterval old, so that a long line
+// is copied once per commit rather than once per key.  A change to other lines
+// is recorded before the line, and one taking the line away makes recording it
+// unneeded, so replaying the records in order still comes out the same.
+void Editor::Journal::linesChanged(int line, int removed, int inserted)
+{
+	if (paused)
+	{
+		return;
+	}
+
+	if (removed == 1 && inserted == 1)
+	{
+		if (deferredLine != line)
+		{
+			flushDeferred();
+			deferredLine = line;
+			deferredSince = std::chrono::steady_clock::now();
+		}
+		flushIfDue();
+		return;
+	}
+
+	if (deferredLine.has_value() && *deferredLine >= line)
+	{
+		if (*deferredLine < line + removed)
+		{
+			deferredLine.reset();
+		}
+		else
+		{
+			*deferredLine += inserted - removed;
+		}
+	}
+	record(line, removed, inserted);
+	flushDeferred();
+}
+
+// The runs are recorded as the buffer tells them, and a line changed in place
+// is recorded after them, where the deletions have left it: by now the buffer
+// holds what it does once they are all done.
+void Editor::Journal::linesDeleted(int line, std::span<std::uint8_t const> marks)
+{
+	if (paused)
+	{
+		return;
+	}
+
+	auto deferred = std::exchange(deferredLine, std::nullopt);
+	if (deferred.has_value() && *deferred >= line)
+	{
+		auto offset = std::min(static_cast<std::size_t>(*deferred - line), marks.size());
+		if (offset < marks.size() && marks[offset] != 0)
+		{
+			deferred.reset();
+		}
+		else
+		{
+			*deferred -= static_cast<int>(std::count_if(
+				marks.begin(), marks.begin() + static_cast<std::ptrdiff_t>(offset), [](auto mark) { return mark != 0; }));
+		}
+	}
+	Observer::linesDeleted(line, marks);
+	deferredLine = deferred;
+	flushDeferred();
+}
+
+bool Editor::Journal::hasDeferredLine() const
+{
+	return deferredLine.has_value();
+}
+
+void Editor::Journal::flushIfDue()
+{
+	if (deferredLine.has_value() && std::chrono::steady_clock::now() - deferredSince >= commitInterval)
+	{
+		flushDeferred();
+	}
+}
+
+void Editor::Journal::flushDeferred()
+{
+	if (deferredLine.has_value())
+	{
+		record(*deferredLine, 1, 1);
+		deferredLine.reset();
+	}
+}
+
+// Only copies the lines, so recording never waits on the disk.
+void Editor::Journal::record(int line, int removed, int inserted)
+{
+	auto payload = std::string{};
+	appendNumber(payload, static_cast<std::uint32_t>(line));
+	appendNumber(payload, static_cast<std::uint32_t>(removed));
+	appendNumber(payload, static_cast<std::uint32_t>(inserted));
+	for (auto i = line; i < line + inserted; i++)
+	{
+		auto text = buffer.getLineText(i);
+		appendNumber(payload, static_cast<std::uint32_t>(text.length()));
+		payload += text.head;
+		payload += text.tail;
+	}
+
+	auto lock = std::lock_guard{mutex};
+	appendNumber(pending, static_cast<std::uint32_t>(payload.size()));
+	appendNumber(pending, checksum(payload));
+	pending += payload;
+	pendingChanged.notify_one();
+}
+
+// Once a change comes in, waits for commitInterval so that the ones following
+// it share the write and the sync.
+void Editor::Journal::run(std::stop_token stopToken)
+{
+	auto batch = std::string{};
+	while (not stopToken.stop_requested())
+	{
+		auto lock = std::unique_lock{mutex};
+		if (not pendingChanged.wait(lock, stopToken, [this] { return not pending.empty(); }))
+		{
+			break;
+		}
+		pendingChanged.wait_for(lock, stopToken, commitInterval, [] { return false; });
+		std::swap(batch, pending);
+		lock.unlock();
+
+		if (writeJournal(fd, batch))
+		{
+			fdatasync(fd);
+		}
+		batch.clear();
+	}
+}
+
+// Records are applied until the first that is cut short, fails its checksum,
+// or does not fit the buffer.
+std::optional<Editor::Journal::Recovery> Editor::Journal::replay(
+	std::filesystem::path const& path, Buffer& buffer, std::optional<FileStamp> current)
+{
+	auto error = std::error_code{};
+	auto size = std::filesystem::file_size(path, error);
+	auto input = std::ifstream(path, std::ios::binary);
+	if (error || not input)
+	{
+		return std::nullopt;
+	}
+	auto contents = std::string(size, '\0');
+	input.read(contents.data(), static_cast<std::streamsize>(size));
+	contents.resize(static_cast<std::size_t>(input.gcount()));
+	if (contents.size() < headerSize || not contents.starts_with(std::string_view{swapMagic.data(), swapMagic.size()}))
+	{
+		return std::nullopt;
+	}
+
+	auto data = std::string_view{contents};
+	auto readNumber = [&data]
+	{
+		auto n = std::uint32_t{0};
+		std::memcpy(&n, data.data(), sizeof n);
+		data.remove_prefix(sizeof n);
+		return n;
+	};
+
+	auto header = data.substr(0, headerSize);
+	data.remove_prefix(headerSize);
+	auto recovery = Recovery{
+		.changes=0,
+		.baseMatches=header == makeHeader(current),
+		.complete=true,
+		.validLength=static_cast<off_t>(headerSize),
+	};
+	while (not data.empty())
+	{
+		if (data.size() < 2 * sizeof(std::uint32_t))
+		{
+			recovery.complete = false;
+			break;
+		}
+		auto length = readNumber();
+		auto sum = readNumber();
+		if (data.size() < length || length < 3 * sizeof(std::uint32_t) || checksum(data.substr(0, length)) != sum)
+		{
+			recovery.complete = false;
+			break;
+		}
+
+		auto end = data.substr(length);
+		data = data.substr(0, length);
+		auto line = static_cast<int>(readNumber());
+		auto removed = static_cast<int>(readNumber());
+		auto inserted = readNumber();
+		auto newLines = std::vector<std::string>{};
+		for (auto i = std::uint32_t{0}; i < inserted && data.size() >= sizeof(std::uint32_t); i++)
+		{
+			auto lineLength = std::min<std::size_t>(readNumber(), data.size());
+			newLines.emplace_back(data.substr(0, lineLength));
+			data.remove_prefix(lineLength);
+		}
+		if (line < 0 || removed < 0 || line + removed > buffer.numLines() || newLines.size() != inserted)
+		{
+			recovery.complete = false;
+			break;
+		}
+
+		buffer.replaceLines(line, removed, std::move(newLines));
+		recovery.changes++;
+		recovery.validLength += static_cast<off_t>(2 * sizeof(std::uint32_t) + length);
+		data = end;
+	}
+	return recovery;
+}
@@ -0,0 +1,1091 @@
+#include "linestore.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string_view>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+LineStore::~LineStore()
+{
+	closeFile();
+}
+
+int LineStore::size() const
+{
+	if (segments.empty())
+	{
+		return 0;
+	}
+	return firstLines.back() + segments.back().lineCount;
+}
+
+std::string const& LineStore::operator[](int line) const
+{
+	auto [segment, offset] = locate(line);
+	auto index = static_cast<std::size_t>(offset);
+	if (auto& source = segments[segment].source; source.has_value())
+	{
+		return load(*source)[index];
+	}
+	return segments[segment].lines[index];
+}
+
+std::size_t lineBytes(std::string const& line)
+{
+	return sizeof(line) + line.length();
+}
+
+std::string& LineStore::edit(int line)
+{
+	settle();
+	auto [segment, offset] = locate(line);
+	auto wasHeld = not segments[segment].source.has_value();
+	materialize(segment);
+	markChanged(segment);
+	auto& text = segments[segment].lines[static_cast<std::size_t>(offset)];
+	if (not wasHeld)
+	{
+		release(segment, segment);
+	}
+	editedText = &text;
+	editedSegment = segment;
+	editedLength = text.length();
+	return text;
+}
+
+// The tail of the segment holding the lines is shifted at most once, so the
+// cost is linear in its size no matter how many lines are inserted or removed.
+// The segments at either end of the range are brought into memory and merged
+// into one; those wholly inside it are dropped unread.
+void LineStore::splice(int line, int count, std::vector<std::string> newLines)
+{
+	assert(line >= 0 && count >= 0);
+	assert(line + count <= size());
+	settle();
+
+	auto insertedBytes = std::size_t{0};
+	for (auto const& text: newLines)
+	{
+		insertedBytes += lineBytes(text);
+	}
+	if (segments.empty())
+	{
+		if (not newLines.empty())
+		{
+			auto lineCount = static_cast<int>(newLines.size());
+			segments.push_back({.lines=std::move(newLines), .lineCount=lineCount, .bytes=insertedBytes});
+			heldBytes += insertedBytes;
+			updateFirstLines();
+		}
+		return;
+	}
+
+	auto first = locate(std::min(line, size() - 1)).first;
+	auto last = count > 0 ? locate(line + count - 1).first : first;
+	if (last > first + 1)  // the segments in between go without being read
+	{
+		count -= firstLines[last] - firstLines[first + 1];
+		for (auto i = first + 1; i < last; i++)
+		{
+			forget(segments[i]);
+		}
+		segments.erase(
+			segments.begin() + static_cast<std::ptrdiff_t>(first) + 1,
+			segments.begin() + static_cast<std::ptrdiff_t>(last)
+		);
+		last = first + 1;
+	}
+	for (auto i = first; i <= last; i++)
+	{
+		materialize(i);
+	}
+	auto& lines = segments[first].lines;
+	auto& bytes = segments[first].bytes;
+	for (auto i = first + 1; i <= last; i++)
+	{
+		std::move(segments[i].lines.begin(), segments[i].lines.end(), std::back_inserter(lines));
+		bytes += segments[i].bytes;
+		freeSpilled(segments[i].unchangedSource);
+	}
+	segments.erase(
+		segments.begin() + static_cast<std::ptrdiff_t>(first) + 1,
+		segments.begin() + static_cast<std::ptrdiff_t>(last) + 1
+	);
+
+	auto inserted = static_cast<int>(newLines.size());
+	auto firstLine = lines.begin() + (line - firstLines[first]);
+	for (auto it = firstLine; it != firstLine + count; ++it)
+	{
+		bytes -= lineBytes(*it);
+		heldBytes -= lineBytes(*it);
+	}
+	bytes += insertedBytes;
+	heldBytes += insertedBytes;
+	auto overlap = std::min(count, inserted);
+	auto newFirst = newLines.begin();
+	firstLine = std::move(newFirst, newFirst + overlap, firstLine);
+	if (count > overlap)
+	{
+		lines.erase(firstLine, firstLine + (count - overlap));
+	}
+	else
+	{
+		lines.insert(
+			firstLine,
+			std::make_move_iterator(newFirst + overlap),
+			std::make_move_iterator(newLines.end())
+		);
+	}
+
+	segments[first].lineCount = static_cast<int>(lines.size());
+	markChanged(first);
+	if (lines.empty())
+	{
+		segments.erase(segments.begin() + static_cast<std::ptrdiff_t>(first));
+	}
+	updateFirstLines();
+	release(first, first);
+}
+
+// A single pass over the segments holding the run: those with no marked lines
+// are left as they are, unread, and every other one is compacted in place.
+void LineStore::erase(int line, Marks const& marks)
+{
+	auto end = line + static_cast<int>(marks.size());
+	assert(line >= 0 && end <= size());
+	settle();
+
+	for (auto i = std::size_t{0}; i < segments.size(); i++)
+	{
+		auto first = std::max(line, firstLines[i]);
+		auto last = std::min(end, firstLines[i] + segments[i].lineCount);
+		if (first >= last)
+		{
+			continue;
+		}
+		auto marked = marks.begin() + (first - line);
+		auto isUnmarked = [](auto mark) { return mark == 0; };
+		if (std::all_of(marked, marked + (last - first), isUnmarked))
+		{
+			continue;
+		}
+		// a segment marked all through goes without being read
+		if (last - first == segments[i].lineCount && std::none_of(marked, marked + (last - first), isUnmarked))
+		{
+			evictionOrder.erase(rankOf(i));
+			forget(segments[i]);
+			segments[i] = Segment{};
+			continue;
+		}
+
+		materialize(i);
+		auto& lines = segments[i].lines;
+		auto kept = static_cast<std::size_t>(first - firstLines[i]);
+		for (auto j = kept; j < lines.size(); j++)
+		{
+			auto at = firstLines[i] + static_cast<int>(j);
+			if (at < last && marks[static_cast<std::size_t>(at - line)] != 0)
+			{
+				segments[i].bytes -= lineBytes(lines[j]);
+				heldBytes -= lineBytes(lines[j]);
+				continue;
+			}
+			if (kept != j)
+			{
+				lines[kept] = std::move(lines[j]);
+			}
+			kept++;
+		}
+		lines.resize(kept);
+		segments[i].lineCount = static_cast<int>(kept);
+		markChanged(i);
+		release(i, i);
+	}
+
+	std::erase_if(segments, [](auto const& segment) { return segment.lineCount == 0; });
+	updateFirstLines();
+}
+
+void LineStore::rearrange(int line, int count, std::vector<int> const& order)
+{
+	assert(line >= 0 && line + count <= size());
+	auto newLines = std::vector<std::string>{};
+	newLines.reserve(order.size());
+	for (auto i: order)
+	{
+		assert(i >= 0 && i < count);
+		newLines.push_back(std::move(edit(line + i)));
+	}
+	splice(line, count, std::move(newLines));
+}
+
+bool LineStore::hold(int line, int count)
+{
+	if (count <= 0)
+	{
+		return true;
+	}
+	settle();
+	auto first = locate(line).first;
+	auto last = locate(line + count - 1).first;
+	if (fd >= 0)
+	{
+		auto bytes = std::size_t{0};
+		for (auto i = first; i <= last; i++)
+		{
+			bytes += segments[i].bytes;
+			if (auto& source = segments[i].source; source.has_value())
+			{
+				bytes += source->length + static_cast<std::size_t>(source->lineCount) * sizeof(std::string);
+			}
+		}
+		if (bytes > memoryLimit)
+		{
+			return false;
+		}
+	}
+	for (auto i = first; i <= last; i++)
+	{
+		materialize(i);
+	}
+	release(first, last);
+	return true;
+}
+
+void LineStore::clear()
+{
+	segments.clear();
+	firstLines.clear();
+	digest.reset();
+	evictionOrder.clear();
+	heldBytes = 0;
+	editedText = nullptr;
+	closeFile();
+}
+
+// Only finds where the chunks of lines lie; nothing is kept but their offsets
+// and a digest of the lines.
+void LineStore::map(std::filesystem::path const& path, std::size_t limit)
+{
+	clear();
+	fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return;
+	}
+	mappedPath = path;
+	memoryLimit = limit;
+	digest.emplace();
+	segments = findChunks(0, -1, &*digest);
+	digest->finish();
+	updateFirstLines();
+}
+
+// Chunks of whole lines in [from, to) of the mapped file, or from `from` to
+// its end for a negative `to`.  The lines are handed to the digest, if any,
+// on the way.
+std::vector<LineStore::Segment> LineStore::findChunks(off_t from, off_t to, FileDigest* lineDigest) const
+{
+	auto found = std::vector<Segment>{};
+	auto block = std::string(chunkSize, '\0');
+	auto chunk = Chunk{.offset=from, .length=0, .lineCount=0};
+	auto unterminated = std::size_t{0};  // bytes since the last newline
+	auto partialLine = std::string{};  // the same bytes, for the digest
+	for (auto offset = from; to < 0 || offset < to; )
+	{
+		auto wanted = to < 0 ? block.size() : std::min(block.size(), static_cast<std::size_t>(to - offset));
+		auto n = pread(fd, block.data(), wanted, offset);
+		if (n <= 0)
+		{
+			break;
+		}
+		offset += n;
+		auto end = block.data() + n;
+		for (auto p = block.data(); p != end; )
+		{
+			auto newline = static_cast<char*>(std::memchr(p, '\n', static_cast<std::size_t>(end - p)));
+			if (newline == nullptr)
+			{
+				chunk.length += static_cast<std::size_t>(end - p);
+				unterminated += static_cast<std::size_t>(end - p);
+				if (lineDigest != nullptr)
+				{
+					partialLine.append(p, end);
+				}
+				break;
+			}
+			if (lineDigest != nullptr)
+			{
+				auto line = std::string_view{p, static_cast<std::size_t>(newline - p)};
+				if (partialLine.empty())
+				{
+					lineDigest->addLine(line);
+				}
+				else
+				{
+					partialLine += line;
+					lineDigest->addLine(partialLine);
+					partialLine.clear();
+				}
+			}
+			chunk.length += static_cast<std::size_t>(newline + 1 - p);
+			chunk.lineCount++;
+			unterminated = 0;
+			p = newline + 1;
+			if (chunk.length >= chunkSize)
+			{
+				found.push_back({.source=chunk, .lineCount=chunk.lineCount});
+				chunk = {.offset=chunk.offset + static_cast<off_t>(chunk.length), .length=0, .lineCount=0};
+			}
+		}
+	}
+	if (unterminated > 0)
+	{
+		chunk.lineCount++;
+		chunk.endsInNewline = false;
+		if (lineDigest != nullptr)
+		{
+			lineDigest->addLine(partialLine, false);
+		}
+	}
+	if (chunk.lineCount > 0)
+	{
+		found.push_back({.source=chunk, .lineCount=chunk.lineCount});
+	}
+	return found;
+}
+
+bool LineStore::isMapped() const
+{
+	return fd >= 0;
+}
+
+std::optional<FileDigest> LineStore::takeDigest()
+{
+	return std::exchange(digest, std::nullopt);
+}
+
+// The chunks before the change stay where they were and those after it are
+// moved by the change in length; only the chunks holding changed lines are
+// looked for again, in the newer file.  Every held line goes back to being
+// read from there.
+bool LineStore::remap(std::filesystem::path const& path, FileDigest::Difference const& difference)
+{
+	settle();
+	auto isChanged = [](Segment const& segment)
+	{
+		auto& source = segment.source.has_value() ? segment.source : segment.unchangedSource;
+		return not source.has_value() || source->isSpilled;
+	};
+	if (fd < 0 || std::any_of(segments.begin(), segments.end(), isChanged))
+	{
+		return false;
+	}
+	auto newFd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (newFd < 0)
+	{
+		return false;
+	}
+	for (auto& segment: segments)
+	{
+		if (not segment.source.has_value())
+		{
+			segment.source = std::exchange(segment.unchangedSource, std::nullopt);
+			segment.lines = std::vector<std::string>{};
+			segment.bytes = 0;
+		}
+	}
+	heldBytes = 0;
+	cache.clear();
+	cachedBytes = 0;
+	::close(fd);
+	fd = newFd;
+	mappedPath = path;
+	digest.reset();
+
+	// [first, last) are the segments holding the changed lines
+	auto first = std::size_t{0};
+	auto last = segments.size();
+	auto expectedLines = difference.inserted;
+	if (not segments.empty())
+	{
+		first = locate(std::min(difference.line, size() - 1)).first;
+		last = difference.removed > 0 ? locate(difference.line + difference.removed - 1).first + 1 : first + 1;
+		expectedLines += firstLines[last - 1] + segments[last - 1].lineCount - firstLines[first] - difference.removed;
+	}
+	auto from = first < segments.size() ? segments[first].source->offset : off_t{0};
+	auto to = off_t{-1};
+	auto shift = static_cast<off_t>(difference.length) - static_cast<off_t>(difference.removedLength);
+	if (last < segments.size())
+	{
+		to = segments[last].source->offset + shift;
+	}
+
+	auto found = findChunks(from, to, nullptr);
+	auto foundLines = 0;
+	for (auto const& segment: found)
+	{
+		foundLines += segment.lineCount;
+	}
+	if (foundLines != expectedLines)  // the file changed again
+	{
+		return false;
+	}
+	for (auto i = last; i < segments.size(); i++)
+	{
+		segments[i].source->offset += shift;
+	}
+	segments.erase(
+		segments.begin() + static_cast<std::ptrdiff_t>(first),
+		segments.begin() + static_cast<std::ptrdiff_t>(last)
+	);
+	segments.insert(segments.begin() + static_cast<std::ptrdiff_t>(first), found.begin(), found.end());
+	updateFirstLines();
+	return true;
+}
+
+// A store mapped onto a file is written to a temporary file that then takes
+// the target's place, as the target may be the very file being copied from.
+// Writing over the mapped file maps the store onto the new one, so the lines
+// that were held in memory can go.
+bool LineStore::write(std::filesystem::path const& path)
+{
+	if (fd < 0)
+	{
+		return writeInMemory(path);
+	}
+
+	auto tempPath = std::string{};
+	auto outputFd = openTemporary(path, tempPath);
+	if (outputFd < 0)
+	{
+		return false;
+	}
+
+	auto written = std::vector<Chunk>{};
+	auto error = std::error_code{};
+	auto overwritesMapped = std::filesystem::equivalent(path, mappedPath, error);
+	if (not writeStreaming(outputFd, 0, size(), written) || not replaceWith(tempPath, outputFd, path))
+	{
+		return false;
+	}
+	if (not overwritesMapped)
+	{
+		::close(outputFd);
+		return true;
+	}
+
+	auto limit = memoryLimit;
+	clear();
+	fd = outputFd;
+	mappedPath = path;
+	memoryLimit = limit;
+	for (auto chunk: written)
+	{
+		segments.push_back({.source=chunk, .lineCount=chunk.lineCount});
+	}
+	updateFirstLines();
+	return true;
+}
+
+// Part of the store is streamed the same way, but the store stays as it is.
+bool LineStore::write(std::filesystem::path const& path, int line, int count)
+{
+	assert(line >= 0 && count >= 0);
+	assert(line + count <= size());
+
+	auto tempPath = std::string{};
+	auto outputFd = openTemporary(path, tempPath);
+	if (outputFd < 0)
+	{
+		return false;
+	}
+	auto written = std::vector<Chunk>{};
+	if (not writeStreaming(outputFd, line, count, written) || not replaceWith(tempPath, outputFd, path))
+	{
+		return false;
+	}
+	::close(outputFd);
+	return true;
+}
+
+// Created next to path, with the mode of the file it is to replace.
+int LineStore::openTemporary(std::filesystem::path const& path, std::string& tempPath)
+{
+	tempPath = path.string() + ".XXXXXX";
+	auto outputFd = mkstemp(tempPath.data());
+	if (outputFd < 0)
+	{
+		return -1;
+	}
+	if (struct stat target{}; ::stat(path.c_str(), &target) == 0)
+	{
+		fchmod(outputFd, target.st_mode & 07777);
+	}
+	else
+	{
+		auto mask = umask(0);
+		umask(mask);
+		fchmod(outputFd, 0666 & ~mask);
+	}
+	return outputFd;
+}
+
+// Closes and removes the temporary file should anything fail.
+bool LineStore::replaceWith(std::string const& tempPath, int outputFd, std::filesystem::path const& path)
+{
+	if (fsync(outputFd) != 0 || std::rename(tempPath.c_str(), path.c_str()) != 0)
+	{
+		::close(outputFd);
+		::unlink(tempPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool LineStore::writeInMemory(std::filesystem::path const& path) const
+{
+	auto fileHandler = std::ofstream(path);
+	for (auto& segment: segments)
+	{
+		for (auto& line: segment.lines)
+		{
+			fileHandler << line << "\n";
+		}
+	}
+	fileHandler.close();
+	return not fileHandler.fail();
+}
+
+bool writeAll(int outputFd, std::string_view data)
+{
+	while (not data.empty())
+	{
+		auto n = ::write(outputFd, data.data(), data.size());
+		if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (n <= 0)
+		{
+			return false;
+		}
+		data.remove_prefix(static_cast<std::size_t>(n));
+	}
+	return true;
+}
+
+// Copies [offset, offset + length) of one file to the end of the other,
+// within the kernel where the filesystems allow it.
+bool copyRange(int inputFd, off_t offset, std::size_t length, int outputFd)
+{
+	while (length > 0)
+	{
+		auto n = copy_file_range(inputFd, &offset, outputFd, nullptr, length, 0);
+		if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (n < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP))
+		{
+			break;
+		}
+		if (n <= 0)
+		{
+			return false;
+		}
+		length -= static_cast<std::size_t>(n);
+	}
+
+	auto block = std::string(std::min(length, LineStore::chunkSize), '\0');
+	while (length > 0)
+	{
+		auto n = pread(inputFd, block.data(), std::min(length, block.size()), offset);
+		if (n <= 0 || not writeAll(outputFd, {block.data(), static_cast<std::size_t>(n)}))
+		{
+			return false;
+		}
+		offset += n;
+		length -= static_cast<std::size_t>(n);
+	}
+	return true;
+}
+
+// Unchanged chunks are copied from the mapped file; lines held in memory are
+// gathered into chunks of about chunkSize before being written.  Only lines
+// [line, line + count) are written, reading the chunks that lie partly
+// outside them.  `written` says where every chunk ended up in the output.
+bool LineStore::writeStreaming(int outputFd, int line, int count, std::vector<Chunk>& written) const
+{
+	auto outputOffset = off_t{0};
+	auto pending = Chunk{.offset=0, .length=0, .lineCount=0};
+	auto pendingText = std::string{};
+	auto flush = [&]
+	{
+		if (pending.lineCount == 0)
+		{
+			return true;
+		}
+		if (not writeAll(outputFd, pendingText))
+		{
+			return false;
+		}
+		pending.offset = outputOffset;
+		pending.length = pendingText.length();
+		written.push_back(pending);
+		outputOffset += static_cast<off_t>(pending.length);
+		pending.lineCount = 0;
+		pendingText.clear();
+		return true;
+	};
+
+	for (auto i = std::size_t{0}; i < segments.size(); i++)
+	{
+		auto& segment = segments[i];
+		auto first = std::max(line, firstLines[i]) - firstLines[i];
+		auto last = std::min(line + count, firstLines[i] + segment.lineCount) - firstLines[i];
+		if (first >= last)
+		{
+			continue;
+		}
+
+		auto& source = segment.source;
+		if (source.has_value() && first == 0 && last == segment.lineCount)
+		{
+			if (not flush() || not copyRange(fileOf(*source), source->offset, source->length, outputFd))
+			{
+				return false;
+			}
+			auto chunk = Chunk{.offset=outputOffset, .length=source->length, .lineCount=source->lineCount};
+			if (not source->endsInNewline)
+			{
+				if (not writeAll(outputFd, "\n"))
+				{
+					return false;
+				}
+				chunk.length++;
+			}
+			written.push_back(chunk);
+			outputOffset += static_cast<off_t>(chunk.length);
+			continue;
+		}
+
+		auto& lines = source.has_value() ? load(*source) : segment.lines;
+		for (auto j = first; j < last; j++)
+		{
+			pendingText += lines[static_cast<std::size_t>(j)];
+			pendingText += '\n';
+			pending.lineCount++;
+			if (pendingText.length() >= chunkSize && not flush())
+			{
+				return false;
+			}
+		}
+	}
+	return flush();
+}
+
+void LineStore::scan(int line, int count, ThreadPool& pool, Visitor const& visit) const
+{
+	struct Piece
+	{
+		std::size_t segment;
+		int first;
+		int last;
+		std::vector<std::string> const* cached;
+	};
+	auto pieces = std::vector<Piece>{};
+	for (auto i = std::size_t{0}; i < segments.size(); i++)
+	{
+		auto& segment = segments[i];
+		auto first = std::max(line, firstLines[i]) - firstLines[i];
+		auto last = std::min(line + count, firstLines[i] + segment.lineCount) - firstLines[i];
+		if (first >= last)
+		{
+			continue;
+		}
+		if (auto& source = segment.source; source.has_value())
+		{
+			// Only looked up here: the threads must not reorder the cache.
+			auto it = cached(*source);
+			pieces.push_back({i, first, last, it != cache.end() ? &it->lines : nullptr});
+			continue;
+		}
+		for (auto start = first; start < last; start += scanPieceLines)
+		{
+			pieces.push_back({i, start, std::min(start + scanPieceLines, last), nullptr});
+		}
+	}
+
+	pool.forEach(pieces.size(), [&](std::size_t n)
+	{
+		auto& piece = pieces[n];
+		auto& segment = segments[piece.segment];
+		auto chunkLines = std::vector<std::string>{};
+		auto* lines = &segment.lines;
+		if (segment.source.has_value())
+		{
+			lines = piece.cached;
+			if (lines == nullptr)
+			{
+				chunkLines = read(*segment.source);
+				lines = &chunkLines;
+			}
+		}
+		auto span = std::span<std::string const>{*lines}.subspan(
+			static_cast<std::size_t>(piece.first), static_cast<std::size_t>(piece.last - piece.first));
+		visit(firstLines[piece.segment] + piece.first, span);
+	});
+}
+
+bool LineStore::write(std::filesystem::path const& path, int line, Marks const& marks)
+{
+	assert(line >= 0 && line + static_cast<int>(marks.size()) <= size());
+
+	auto tempPath = std::string{};
+	auto outputFd = openTemporary(path, tempPath);
+	if (outputFd < 0)
+	{
+		return false;
+	}
+	auto text = std::string{};
+	auto written = true;
+	for (auto i = std::size_t{0}; i < marks.size() && written; i++)
+	{
+		if (marks[i] != 0)
+		{
+			text += (*this)[line + static_cast<int>(i)];
+			text += '\n';
+		}
+		if (text.length() >= chunkSize || i + 1 == marks.size())
+		{
+			written = writeAll(outputFd, text);
+			text.clear();
+		}
+	}
+	if (not written || not replaceWith(tempPath, outputFd, path))
+	{
+		return false;
+	}
+	::close(outputFd);
+	return true;
+}
+
+std::pair<std::size_t, int> LineStore::locate(int line) const
+{
+	assert(line >= 0 && line < size());
+	auto it = std::upper_bound(firstLines.begin(), firstLines.end(), line) - 1;
+	return {static_cast<std::size_t>(it - firstLines.begin()), line - *it};
+}
+
+// Keeps chunks that were read until they and the held segments add up to more
+// than the memory limit, except the two used last.
+std::vector<std::string> const& LineStore::load(Chunk chunk) const
+{
+	auto it = cached(chunk);
+	if (it != cache.end())
+	{
+		cache.splice(cache.begin(), cache, it);
+		return cache.front().lines;
+	}
+
+	auto lines = read(chunk);
+	auto bytes = chunk.length + lines.size() * sizeof(std::string);
+	cache.push_front({.offset=chunk.offset, .isSpilled=chunk.isSpilled, .bytes=bytes, .lines=std::move(lines)});
+	cachedBytes += bytes;
+	while (cachedBytes + heldBytes > memoryLimit && cache.size() > 2)
+	{
+		cachedBytes -= cache.back().bytes;
+		cache.pop_back();
+	}
+	return cache.front().lines;
+}
+
+std::vector<std::string> LineStore::read(Chunk chunk) const
+{
+	auto data = std::string(chunk.length, '\0');
+	auto done = std::size_t{0};
+	while (done < chunk.length)
+	{
+		auto n = pread(fileOf(chunk), data.data() + done, chunk.length - done, chunk.offset + static_cast<off_t>(done));
+		if (n <= 0)  // the file was cut short behind our back
+		{
+			break;
+		}
+		done += static_cast<std::size_t>(n);
+	}
+	data.resize(done);
+
+	auto lines = std::vector<std::string>{};
+	lines.reserve(static_cast<std::size_t>(chunk.lineCount));
+	for (auto start = std::size_t{0}; start < data.length(); )
+	{
+		auto end = std::min(data.find('\n', start), data.length());
+		lines.emplace_back(data, start, end - start);
+		start = end + 1;
+	}
+	lines.resize(static_cast<std::size_t>(chunk.lineCount));
+	return lines;
+}
+
+void LineStore::materialize(std::size_t segment)
+{
+	evictionOrder.erase(rankOf(segment));
+	segments[segment].lastUsed = ++uses;
+	auto& source = segments[segment].source;
+	if (not source.has_value())
+	{
+		evictionOrder.insert(rankOf(segment));
+		return;
+	}
+
+	auto it = cached(*source);
+	if (it != cache.end())
+	{
+		segments[segment].lines = std::move(it->lines);
+		cachedBytes -= it->bytes;
+		cache.erase(it);
+	}
+	else
+	{
+		segments[segment].lines = read(*source);
+	}
+	auto bytes = std::size_t{0};
+	for (auto const& line: segments[segment].lines)
+	{
+		bytes += lineBytes(line);
+	}
+	segments[segment].bytes = bytes;
+	segments[segment].unchangedSource = source;
+	source.reset();
+	heldBytes += bytes;
+	evictionOrder.insert(rankOf(segment));
+}
+
+// A spilled copy of the lines is of no more use once they change.
+void LineStore::markChanged(std::size_t segment)
+{
+	evictionOrder.erase(rankOf(segment));
+	freeSpilled(segments[segment].unchangedSource);
+	segments[segment].unchangedSource.reset();
+	evictionOrder.insert(rankOf(segment));
+}
+
+// For a segment about to be dropped.
+void LineStore::forget(Segment const& segment)
+{
+	heldBytes -= segment.bytes;
+	freeSpilled(segment.source);
+	freeSpilled(segment.unchangedSource);
+}
+
+// Counts the change made through the line edit last handed out.
+void LineStore::settle()
+{
+	if (editedText == nullptr)
+	{
+		return;
+	}
+	auto& bytes = segments[editedSegment].bytes;
+	bytes = bytes - editedLength + editedText->length();
+	heldBytes = heldBytes - editedLength + editedText->length();
+	editedText = nullptr;
+}
+
+LineStore::Rank LineStore::rankOf(std::size_t segment) const
+{
+	auto& s = segments[segment];
+	return {not s.unchangedSource.has_value(), s.lastUsed, segment};
+}
+
+// Once the cache is down to the two chunks used last, lets go of held
+// segments outside [keepFirst, keepLast] until all fits in the memory limit:
+// unchanged ones before changed ones, and of each those used longest ago first.
+void LineStore::release(std::size_t keepFirst, std::size_t keepLast)
+{
+	if (fd < 0)
+	{
+		return;
+	}
+	while (cachedBytes + heldBytes > memoryLimit)
+	{
+		if (cache.size() > 2)
+		{
+			cachedBytes -= cache.back().bytes;
+			cache.pop_back();
+			continue;
+		}
+
+		auto it = std::find_if(evictionOrder.begin(), evictionOrder.end(), [&](Rank const& rank)
+		{
+			auto i = std::get<2>(rank);
+			return i < keepFirst || i > keepLast;
+		});
+		if (it == evictionOrder.end())
+		{
+			return;
+		}
+
+		auto victim = std::get<2>(*it);
+		auto& segment = segments[victim];
+		auto bytes = segment.bytes;
+		if (segment.unchangedSource.has_value())
+		{
+			segment.source = segment.unchangedSource;
+			segment.unchangedSource.reset();
+			segment.lines = std::vector<std::string>{};
+			segment.bytes = 0;
+		}
+		else if (not spill(victim))
+		{
+			return;
+		}
+		heldBytes -= bytes;
+		evictionOrder.erase(it);
+	}
+}
+
+// The spill file is made next to the mapped one and unlinked at once, so that
+// it goes with the store.  Each segment spilled is written to it whole, into
+// the first gap it fits in or else at the end.
+bool LineStore::spill(std::size_t segment)
+{
+	if (spillFd < 0)
+	{
+		auto tempPath = std::string{};
+		spillFd = openTemporary(mappedPath, tempPath);
+		if (spillFd < 0)
+		{
+			return false;
+		}
+		::unlink(tempPath.c_str());
+	}
+
+	auto& s = segments[segment];
+	auto text = std::string{};
+	text.reserve(s.bytes);
+	for (auto const& line: s.lines)
+	{
+		text += line;
+		text += '\n';
+	}
+	auto gap = std::find_if(spillGaps.begin(), spillGaps.end(), [&](auto const& g) { return g.second >= text.length(); });
+	auto offset = gap != spillGaps.end() ? gap->first : spillEnd;
+	if (::lseek(spillFd, offset, SEEK_SET) != offset || not writeAll(spillFd, text))
+	{
+		return false;
+	}
+	if (gap == spillGaps.end())
+	{
+		spillEnd += static_cast<off_t>(text.length());
+	}
+	else
+	{
+		if (auto rest = gap->second - text.length(); rest > 0)
+		{
+			spillGaps[offset + static_cast<off_t>(text.length())] = rest;
+		}
+		spillGaps.erase(gap);
+	}
+	s.source = Chunk{.offset=offset, .length=text.length(), .lineCount=s.lineCount, .isSpilled=true};
+	s.lines = std::vector<std::string>{};
+	s.bytes = 0;
+	return true;
+}
+
+// Gives the extent of a spilled chunk back for reuse, joined with the gaps on
+// either side of it; a gap reaching the end of the file shortens it instead.
+void LineStore::freeSpilled(std::optional<Chunk> const& chunk)
+{
+	if (not chunk.has_value() || not chunk->isSpilled)
+	{
+		return;
+	}
+	if (auto it = cached(*chunk); it != cache.end())
+	{
+		cachedBytes -= it->bytes;
+		cache.erase(it);
+	}
+
+	auto offset = chunk->offset;
+	auto length = chunk->length;
+	if (auto next = spillGaps.find(offset + static_cast<off_t>(length)); next != spillGaps.end())
+	{
+		length += next->second;
+		spillGaps.erase(next);
+	}
+	if (auto previous = spillGaps.lower_bound(offset); previous != spillGaps.begin())
+	{
+		--previous;
+		if (previous->first + static_cast<off_t>(previous->second) == offset)
+		{
+			offset = previous->first;
+			length += previous->second;
+			spillGaps.erase(previous);
+		}
+	}
+	if (offset + static_cast<off_t>(length) == spillEnd)
+	{
+		spillEnd = offset;
+		return;
+	}
+	spillGaps[offset] = length;
+}
+
+int LineStore::fileOf(Chunk chunk) const
+{
+	return chunk.isSpilled ? spillFd : fd;
+}
+
+std::list<LineStore::CachedChunk>::iterator LineStore::cached(Chunk chunk) const
+{
+	return std::find_if(cache.begin(), cache.end(), [&](auto const& c)
+	{
+		return c.offset == chunk.offset && c.isSpilled == chunk.isSpilled;
+	});
+}
+
+void LineStore::updateFirstLines()
+{
+	firstLines.resize(segments.size());
+	evictionOrder.clear();
+	auto line = 0;
+	for (auto i = std::size_t{0}; i < segments.size(); i++)
+	{
+		firstLines[i] = line;
+		line += segments[i].lineCount;
+		if (not segments[i].source.has_value())
+		{
+			evictionOrder.insert(rankOf(i));
+		}
+	}
+}
+
+void LineStore::closeFile()
+{
+	cache.clear();
+	cachedBytes = 0;
+	if (fd >= 0)
+	{
+		::close(fd);
+		fd = -1;
+	}
+	if (spillFd >= 0)
+	{
+		::close(spillFd);
+		spillFd = -1;
+		spillEnd = 0;
+		spillGaps.clear();
+	}
+	mappedPath.clear();
+}
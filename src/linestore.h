@@ -0,0 +1,163 @@
+#ifndef SRC_LINESTORE_H_
+#define SRC_LINESTORE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <list>
+#include <map>
+#include <optional>
+#include <set>
+#include <span>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "filedigest.h"
+#include "threadpool.h"
+
+// The lines of a buffer.  Usually they all live in memory, but a store mapped
+// onto a large file only knows where each chunk of whole lines lies in it and
+// reads chunks as their lines are looked at, keeping the recently used ones
+// up to a memory limit.  Chunks held in memory, to be changed or for hold,
+// count against the limit too; once it is passed, unchanged ones go back to
+// being read from the file and changed ones are spilled to a temporary file,
+// those used longest ago first.  Chunks still in either file are copied
+// straight from there when written.
+class LineStore
+{
+public:
+	LineStore() = default;
+	~LineStore();
+	LineStore(LineStore const&) = delete;
+	LineStore& operator=(LineStore const&) = delete;
+
+	int size() const;
+
+	// References into a chunk read from the file stay valid until lines from
+	// two other chunks have been looked at.
+	std::string const& operator[](int line) const;
+	std::string& edit(int line);
+
+	// Replaces lines [line, line + count) with newLines.
+	void splice(int line, int count, std::vector<std::string> newLines);
+
+	// One per line of a run of lines, nonzero for those picked out.
+	using Marks = std::vector<std::uint8_t>;
+	// Removes the marked lines of the run starting at `line`.
+	void erase(int line, Marks const&);
+	// Replaces lines [line, line + count) with those at line + order[i], each
+	// taken at most once; the strings are moved, not copied.  The lines must
+	// have been held.
+	void rearrange(int line, int count, std::vector<int> const& order);
+	// Brings lines [line, line + count) into memory for good, so that
+	// references to them stay valid until the store next changes.  A mapped
+	// store refuses, holding nothing, lines that would not fit in its limit.
+	[[nodiscard]] bool hold(int line, int count);
+	void clear();
+
+	void map(std::filesystem::path const&, std::size_t memoryLimit);
+	bool isMapped() const;
+	// The digest of the file last mapped, taken while finding its chunks.
+	std::optional<FileDigest> takeDigest();
+	// Brings a store mapped onto a file, and unchanged since, in line with a
+	// newer version of it that differs as the difference says.  Refuses a
+	// store with changed lines, and leaves it to be mapped again.
+	[[nodiscard]] bool remap(std::filesystem::path const&, FileDigest::Difference const&);
+	[[nodiscard]] bool write(std::filesystem::path const&);
+	[[nodiscard]] bool write(std::filesystem::path const&, int line, int count);
+	[[nodiscard]] bool write(std::filesystem::path const&, int line, Marks const&);
+
+	// Hands lines [line, line + count) to `visit` a piece at a time, the pieces
+	// spread over the pool's threads; each is given the index of its first line.
+	// Chunks not yet read are read by the thread visiting them and not cached.
+	using Visitor = std::function<void(int firstLine, std::span<std::string const>)>;
+	void scan(int line, int count, ThreadPool&, Visitor const&) const;
+
+	static constexpr auto chunkSize = std::size_t{1} << 20;
+	static constexpr auto scanPieceLines = 1 << 16;  // of lines held in memory
+
+private:
+	struct Chunk
+	{
+		off_t offset;
+		std::size_t length;
+		int lineCount;
+		bool endsInNewline{true};  // only the last one in a file may not
+		bool isSpilled{false};  // lies in the spill file, not the mapped one
+	};
+
+	struct Segment
+	{
+		std::optional<Chunk> source{};  // unchanged lines still in the file
+		std::vector<std::string> lines{};
+		int lineCount{0};
+		std::optional<Chunk> unchangedSource{};  // of held lines not changed since
+		std::size_t bytes{0};  // held
+		std::uint64_t lastUsed{0};
+	};
+
+	std::pair<std::size_t, int> locate(int line) const;
+	std::vector<Segment> findChunks(off_t from, off_t to, FileDigest*) const;
+	std::vector<std::string> const& load(Chunk) const;
+	std::vector<std::string> read(Chunk) const;
+	void materialize(std::size_t segment);
+	void markChanged(std::size_t segment);
+	void forget(Segment const&);
+	void settle();
+	void release(std::size_t keepFirst, std::size_t keepLast);
+	bool spill(std::size_t segment);
+	void freeSpilled(std::optional<Chunk> const&);
+	int fileOf(Chunk) const;
+	void updateFirstLines();
+	void closeFile();
+
+	bool writeInMemory(std::filesystem::path const&) const;
+	bool writeStreaming(int outputFd, int line, int count, std::vector<Chunk>& written) const;
+	static int openTemporary(std::filesystem::path const&, std::string& tempPath);
+	static bool replaceWith(std::string const& tempPath, int outputFd, std::filesystem::path const&);
+
+	std::vector<Segment> segments{};
+	std::vector<int> firstLines{};  // of each segment
+
+	// Held segments in the order release lets them go: unchanged ones before
+	// changed ones, and of each those used longest ago first.  Rebuilt with
+	// firstLines, as the segments' indexes shift.
+	using Rank = std::tuple<bool, std::uint64_t, std::size_t>;
+	Rank rankOf(std::size_t segment) const;
+	std::set<Rank> evictionOrder{};
+	std::size_t heldBytes{0};
+
+	int fd{-1};
+	std::filesystem::path mappedPath{};
+	std::optional<FileDigest> digest{};
+	std::size_t memoryLimit{0};
+	std::uint64_t uses{0};
+
+	// The line edit last handed out, counted into its segment's bytes at the
+	// next call that may need them.
+	std::string const* editedText{nullptr};
+	std::size_t editedSegment{0};
+	std::size_t editedLength{0};
+
+	int spillFd{-1};
+	off_t spillEnd{0};
+	std::map<off_t, std::size_t> spillGaps{};  // lengths of the unused extents
+
+	struct CachedChunk
+	{
+		off_t offset;
+		bool isSpilled;
+		std::size_t bytes;
+		std::vector<std::string> lines;
+	};
+	std::list<CachedChunk>::iterator cached(Chunk) const;
+	mutable std::list<CachedChunk> cache{};  // most recently used first
+	mutable std::size_t cachedBytes{0};
+};
+
+#endif // SRC_LINESTORE_H_
@@ -1,13 +1,70 @@
+#include <clocale>
+#include <cstdio>
+#include <cstdlib>
+
+#include <unistd.h>
+
 #include "ncursespp/ncurses.h"
 
 #include "editor.h"
 
 int main(int argc, char** argv)
 {
+	auto memoryLimit = Editor::Buffer::defaultMemoryLimit;
+	auto follow = false;
+	auto recover = false;
+	for (auto option = getopt(argc, argv, "fm:r"); option != -1; option = getopt(argc, argv, "fm:r"))
+	{
+		switch (option)
+		{
+			case 'f':  // keep reading what gets appended to the file
+				follow = true;
+				break;
+
+			case 'm':  // MiB to keep of a large file in memory
+			{
+				char* end;
+				auto megabytes = std::strtoul(optarg, &end, 10);
+				if (*end != '\0' || megabytes == 0)
+				{
+					std::fprintf(stderr, "%s: invalid memory limit `%s'\n", argv[0], optarg);
+					return 1;
+				}
+				memoryLimit = std::size_t{megabytes} << 20;
+				break;
+			}
+
+			case 'r':  // replay the changes left in the swap file
+				recover = true;
+				break;
+
+			default:
+				std::fprintf(stderr, "usage: %s [-f] [-m MiB] [-r] [file]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (recover && optind >= argc)
+	{
+		std::fprintf(stderr, "%s: -r needs a file name\n", argv[0]);
+		return 1;
+	}
+
+	// curses shows UTF-8 only in a locale that has it; the rest is left as in C
+	std::setlocale(LC_CTYPE, "");
 	auto editor = Editor{};
-	if (argc > 1)  // got a filename
+	editor.setMemoryLimit(memoryLimit);
+	if (optind < argc)  // got a filename
 	{
-		editor.open(argv[1]);
+		if (recover)
+		{
+			editor.recover(argv[optind]);
+		}
+		else
+		{
+			editor.open(argv[optind]);
+		}
+		editor.follow(follow);
 	}
 	return editor.mainLoop();
 }
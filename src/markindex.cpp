@@ -0,0 +1,205 @@
+#include "editor.h"
+
+#include <algorithm>
+#include <cassert>
+
+Editor::MarkIndex::MarkIndex(Buffer& b)
+	: buffer{b}
+{
+	buffer.attach(this);
+}
+
+Editor::MarkIndex::~MarkIndex()
+{
+	buffer.detach(this);
+}
+
+void Editor::MarkIndex::set(int id, int line)
+{
+	assert(line >= 0);
+	if (auto it = nodeOfId.find(id); it != nodeOfId.end())
+	{
+		unlink(it->second);
+		freeNodes.push_back(it->second);
+	}
+	auto node = newNode(id, line);
+	nodeOfId[id] = node;
+	auto [before, after] = split(root, line);
+	root = merge(merge(before, node), after);
+}
+
+// The shifts not yet passed down are those of the nodes above.
+std::optional<int> Editor::MarkIndex::line(int id) const
+{
+	auto it = nodeOfId.find(id);
+	if (it == nodeOfId.end())
+	{
+		return std::nullopt;
+	}
+	auto line = nodes[it->second].line;
+	for (auto node = nodes[it->second].parent; node != none;)
+	{
+		line += nodes[node].shift;
+		node = nodes[node].parent;
+	}
+	return line;
+}
+
+// Marks on lines that were changed in place stay; those on lines taken away
+// go, and those after move by the difference.  The lines :g deletes come one
+// run at a time, so the marks on the lines between the runs keep their lines.
+void Editor::MarkIndex::linesChanged(int line, int removed, int inserted)
+{
+	assert(line >= 0 && removed >= 0 && inserted >= 0);
+	if (removed == inserted || root == none)
+	{
+		return;
+	}
+	auto [before, rest] = split(root, line + std::min(removed, inserted));
+	auto [gone, after] = split(rest, line + removed);
+	freeTree(gone);
+	shiftTree(after, inserted - removed);
+	root = merge(before, after);
+}
+
+std::size_t Editor::MarkIndex::newNode(int id, int line)
+{
+	auto node = Node{.id=id, .line=line, .shift=0, .priority=priorities()};
+	if (freeNodes.empty())
+	{
+		nodes.push_back(node);
+		return nodes.size() - 1;
+	}
+	auto index = freeNodes.back();
+	freeNodes.pop_back();
+	nodes[index] = node;
+	return index;
+}
+
+void Editor::MarkIndex::freeTree(std::size_t node)
+{
+	auto pending = std::vector<std::size_t>{};
+	if (node != none)
+	{
+		pending.push_back(node);
+	}
+	while (not pending.empty())
+	{
+		auto const& n = nodes[pending.back()];
+		freeNodes.push_back(pending.back());
+		pending.pop_back();
+		nodeOfId.erase(n.id);
+		for (auto child: {n.left, n.right})
+		{
+			if (child != none)
+			{
+				pending.push_back(child);
+			}
+		}
+	}
+}
+
+void Editor::MarkIndex::shiftTree(std::size_t node, int by)
+{
+	if (node != none)
+	{
+		nodes[node].line += by;
+		nodes[node].shift += by;
+	}
+}
+
+void Editor::MarkIndex::pushShift(std::size_t node)
+{
+	auto& n = nodes[node];
+	shiftTree(n.left, n.shift);
+	shiftTree(n.right, n.shift);
+	n.shift = 0;
+}
+
+// Points the node's children back at it; a node handed back on its own has no
+// parent until it is adopted in turn.
+void Editor::MarkIndex::adopt(std::size_t node)
+{
+	auto const& n = nodes[node];
+	for (auto child: {n.left, n.right})
+	{
+		if (child != none)
+		{
+			nodes[child].parent = node;
+		}
+	}
+	nodes[node].parent = none;
+}
+
+std::pair<std::size_t, std::size_t> Editor::MarkIndex::split(std::size_t node, int line)
+{
+	if (node == none)
+	{
+		return {none, none};
+	}
+	pushShift(node);
+	auto& n = nodes[node];
+	if (n.line < line)
+	{
+		auto [before, after] = split(n.right, line);
+		nodes[node].right = before;
+		adopt(node);
+		return {node, after};
+	}
+	auto [before, after] = split(n.left, line);
+	nodes[node].left = after;
+	adopt(node);
+	return {before, node};
+}
+
+// Every line in `first` comes before every line in `second`.
+std::size_t Editor::MarkIndex::merge(std::size_t first, std::size_t second)
+{
+	if (first == none || second == none)
+	{
+		auto node = first == none ? second : first;
+		if (node != none)
+		{
+			nodes[node].parent = none;
+		}
+		return node;
+	}
+	if (nodes[first].priority > nodes[second].priority)
+	{
+		pushShift(first);
+		auto right = merge(nodes[first].right, second);
+		nodes[first].right = right;
+		adopt(first);
+		return first;
+	}
+	pushShift(second);
+	auto left = merge(first, nodes[second].left);
+	nodes[second].left = left;
+	adopt(second);
+	return second;
+}
+
+// Takes the node out of the tree, its children merged in its place.
+void Editor::MarkIndex::unlink(std::size_t node)
+{
+	pushShift(node);
+	auto const& n = nodes[node];
+	auto parent = n.parent;
+	auto children = merge(n.left, n.right);
+	if (children != none)
+	{
+		nodes[children].parent = parent;
+	}
+	if (parent == none)
+	{
+		root = children;
+	}
+	else if (nodes[parent].left == node)
+	{
+		nodes[parent].left = children;
+	}
+	else
+	{
+		nodes[parent].right = children;
+	}
+}
@@ -0,0 +1,293 @@
+#include "editor.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <mutex>
+
+Editor::OffsetIndex::OffsetIndex(Buffer& b, ThreadPool& p)
+	: buffer{b}, pool{p}
+{
+	buffer.attach(this);
+}
+
+Editor::OffsetIndex::~OffsetIndex()
+{
+	buffer.detach(this);
+}
+
+Editor::OffsetIndex::Sums Editor::OffsetIndex::measure(Buffer::LineText text)
+{
+	auto stops = text.length();
+	if (not isAscii(text.head) || not isAscii(text.tail))
+	{
+		stops = 0;
+		for (auto i = std::size_t{0}; i < text.length(); i = nextCharacter(text, i))
+		{
+			stops++;
+		}
+	}
+	return {
+		.lines=1,
+		.bytes=static_cast<std::int64_t>(text.length() + 1),
+		.stops=static_cast<std::int64_t>(std::max(stops, std::size_t{1})),
+	};
+}
+
+Editor::OffsetIndex::Sums Editor::OffsetIndex::measure(std::int64_t firstLine, std::int64_t lastLine) const
+{
+	auto sums = Sums{};
+	for (auto line = firstLine; line < lastLine; line++)
+	{
+		sums.add(measure(buffer.getLineText(static_cast<int>(line))));
+	}
+	return sums;
+}
+
+Editor::OffsetIndex::Offset Editor::OffsetIndex::start(int line) const
+{
+	assert(line >= 0 && line <= buffer.numLines());
+	refresh();
+	auto sums = find(line, &Sums::lines).second;
+	sums.add(measure(sums.lines, line));
+	return {.bytes=sums.bytes, .stops=sums.stops};
+}
+
+int Editor::OffsetIndex::lineAtByte(std::int64_t byte) const
+{
+	return lineAt(byte, &Sums::bytes);
+}
+
+int Editor::OffsetIndex::lineAtStop(std::int64_t stop) const
+{
+	return lineAt(stop, &Sums::stops);
+}
+
+int Editor::OffsetIndex::lineAt(std::int64_t offset, std::int64_t Sums::* member) const
+{
+	refresh();
+	if (offset < 0)
+	{
+		return 0;
+	}
+	auto [block, sums] = find(offset, member);
+	if (block == blocks.size())
+	{
+		return static_cast<int>(sums.lines);
+	}
+	for (auto end = sums.lines + blocks[block].lines; sums.lines < end;)
+	{
+		auto size = measure(buffer.getLineText(static_cast<int>(sums.lines)));
+		if (sums.*member + size.*member > offset)
+		{
+			break;
+		}
+		sums.add(size);
+	}
+	return static_cast<int>(sums.lines);
+}
+
+// Down the tree to the last block ending at or before the offset; blocks left
+// empty by deletions are passed over.
+std::pair<std::size_t, Editor::OffsetIndex::Sums> Editor::OffsetIndex::find(
+	std::int64_t offset, std::int64_t Sums::* member) const
+{
+	auto block = std::size_t{0};
+	auto sums = Sums{};
+	for (auto step = std::bit_floor(tree.size()); step > 0; step /= 2)
+	{
+		if (block + step < tree.size() && sums.*member + tree[block + step].*member <= offset)
+		{
+			block += step;
+			sums.add(tree[block]);
+		}
+	}
+	return {block, sums};
+}
+
+Editor::OffsetIndex::Sums Editor::OffsetIndex::before(std::size_t block) const
+{
+	auto sums = Sums{};
+	for (auto node = block; node > 0; node &= node - 1)
+	{
+		sums.add(tree[node]);
+	}
+	return sums;
+}
+
+// Until the index is first asked about nothing is kept.  The line counts in
+// the tree are always up to date, so the blocks holding the lines that change
+// are found there; their bytes and stops are left as they were until the
+// blocks are summed again.
+void Editor::OffsetIndex::linesChanged(int line, int removed, int inserted)
+{
+	assert(line >= 0 && removed >= 0 && inserted >= 0);
+	if (not isBuilt)
+	{
+		return;
+	}
+	if (static_cast<std::size_t>(inserted / blockLines) > maxStaleBlocks)
+	{
+		forget();
+		return;
+	}
+	auto kept = std::min(removed, inserted);
+	for (auto changed = std::int64_t{line}; changed < line + kept;)
+	{
+		auto [block, sums] = find(changed, &Sums::lines);
+		markStale(block);
+		changed = sums.lines + blocks[block].lines;
+	}
+	removeLines(line + kept, removed - kept);
+	insertLines(line + kept, inserted - kept);
+	if (staleBlocks.size() > maxStaleBlocks)
+	{
+		forget();
+	}
+}
+
+void Editor::OffsetIndex::removeLines(std::int64_t line, std::int64_t count)
+{
+	while (count > 0)
+	{
+		auto [block, sums] = find(line, &Sums::lines);
+		auto taken = std::min(count, sums.lines + blocks[block].lines - line);
+		blocks[block].lines -= taken;
+		add(block, {.lines=-taken});
+		markStale(block);
+		count -= taken;
+	}
+}
+
+// Lines added after the last one go at the end of the last block.
+void Editor::OffsetIndex::insertLines(std::int64_t line, std::int64_t count)
+{
+	if (count == 0)
+	{
+		return;
+	}
+	auto block = std::min(find(line, &Sums::lines).first, blocks.size() - 1);
+	blocks[block].lines += count;
+	add(block, {.lines=count});
+	markStale(block);
+	if (blocks[block].lines > maxBlockLines)
+	{
+		split(block);
+	}
+}
+
+// The first part keeps the sums the block had, which are what the tree holds
+// for it until it is summed again; the other parts start out with none.
+void Editor::OffsetIndex::split(std::size_t block)
+{
+	auto lines = blocks[block].lines;
+	auto parts = static_cast<std::size_t>((lines + blockLines - 1) / blockLines);
+	auto rest = std::vector<Sums>(parts - 1, Sums{.lines=blockLines});
+	rest.back().lines = lines - blockLines * static_cast<std::int64_t>(parts - 1);
+	blocks[block].lines = blockLines;
+	blocks.insert(blocks.begin() + static_cast<std::ptrdiff_t>(block) + 1, rest.begin(), rest.end());
+	for (auto& stale: staleBlocks)
+	{
+		stale += stale > block ? parts - 1 : 0;
+	}
+	for (auto part = block + 1; part < block + parts; part++)
+	{
+		staleBlocks.push_back(part);
+	}
+	buildTree();
+}
+
+void Editor::OffsetIndex::markStale(std::size_t block)
+{
+	if (staleBlocks.empty() || staleBlocks.back() != block)
+	{
+		staleBlocks.push_back(block);
+	}
+}
+
+void Editor::OffsetIndex::forget()
+{
+	isBuilt = false;
+	blocks = {};
+	tree = {};
+	staleBlocks = {};
+}
+
+void Editor::OffsetIndex::refresh() const
+{
+	if (not isBuilt)
+	{
+		build();
+		return;
+	}
+	std::sort(staleBlocks.begin(), staleBlocks.end());
+	staleBlocks.erase(std::unique(staleBlocks.begin(), staleBlocks.end()), staleBlocks.end());
+	for (auto block: staleBlocks)
+	{
+		auto first = before(block).lines;
+		auto sums = measure(first, first + blocks[block].lines);
+		auto change = sums;
+		change.add(blocks[block], -1);
+		add(block, change);
+		blocks[block] = sums;
+	}
+	staleBlocks.clear();
+}
+
+// The pieces of the scan need not start on a block boundary, so each is cut
+// into blocks of its own.
+void Editor::OffsetIndex::build() const
+{
+	auto piecesMutex = std::mutex{};
+	auto pieces = std::vector<std::pair<int, std::vector<Sums>>>{};
+	buffer.scan(0, buffer.numLines(), pool, [&](int firstLine, std::span<std::string const> lines)
+	{
+		auto piece = std::vector<Sums>{};
+		for (auto const& text: lines)
+		{
+			if (piece.empty() || piece.back().lines == blockLines)
+			{
+				piece.emplace_back();
+			}
+			piece.back().add(measure({.head=text}));
+		}
+		auto lock = std::lock_guard{piecesMutex};
+		pieces.emplace_back(firstLine, std::move(piece));
+	});
+	std::sort(pieces.begin(), pieces.end(), [](auto const& a, auto const& b) { return a.first < b.first; });
+	blocks.clear();
+	for (auto const& [firstLine, piece]: pieces)
+	{
+		blocks.insert(blocks.end(), piece.begin(), piece.end());
+	}
+	if (blocks.empty())
+	{
+		blocks.emplace_back();
+	}
+	staleBlocks.clear();
+	isBuilt = true;
+	buildTree();
+}
+
+// Each node of the tree sums the blocks below it, and a parent's node takes
+// in its child's once the child is complete.
+void Editor::OffsetIndex::buildTree() const
+{
+	tree.assign(blocks.size() + 1, Sums{});
+	std::copy(blocks.begin(), blocks.end(), tree.begin() + 1);
+	for (auto node = std::size_t{1}; node < tree.size(); node++)
+	{
+		if (auto parent = node + (node & -node); parent < tree.size())
+		{
+			tree[parent].add(tree[node]);
+		}
+	}
+}
+
+void Editor::OffsetIndex::add(std::size_t block, Sums change) const
+{
+	for (auto node = block + 1; node < tree.size(); node += node & -node)
+	{
+		tree[node].add(change);
+	}
+}
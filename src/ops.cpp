@@ -1,6 +1,40 @@
 #include "ops.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <limits>
+
+#include "utf8.h"
+#include "words.h"
+
+// Columns are bytes, but the cursor only ever sits at the start of a character.
+// One kept while moving to another line may fall past its end or inside one.
+int columnOnLine(Editor::Buffer const& buffer, int line, int col)
+{
+	if (buffer.isEmpty())
+	{
+		return 0;
+	}
+	auto text = buffer.getLineText(line);
+	auto length = static_cast<int>(text.length());
+	if (col > length)
+	{
+		col = std::max(0, length - 1);
+	}
+	return static_cast<int>(characterStart(text, static_cast<std::size_t>(col)));
+}
+
+// Where the character `count` on from the one at byte `col` starts, or the end.
+int columnAfter(Editor::Buffer::LineText text, int col, int count)
+{
+	auto i = static_cast<std::size_t>(col);
+	for (; count > 0 && i < text.length(); count--)
+	{
+		i = nextCharacter(text, i);
+	}
+	return static_cast<int>(i);
+}
 
 [[nodiscard]] OperatorResult moveCursor(OperatorArgs args)
 {
@@ -13,62 +47,84 @@
 
 	auto lastValidOffset = [&](int index)
 	{
-		auto lineLength = args.buffer.lineLength(index);
-		if (lineLength == 0)
-			return 0;
-		return lineLength + (args.currentMode == Editor::Mode::Insert ? 0 : -1);
+		auto text = args.buffer.getLineText(index);
+		if (args.currentMode == Editor::Mode::Insert)
+			return static_cast<int>(text.length());
+		return static_cast<int>(previousCharacter(text, text.length()));
 	};
 
 	auto toMove = args.count.value_or(1);
 
+	// The cursor stops at each character and once on an empty line.  A count
+	// that takes it through more than a few lines is turned into a line and
+	// column through the offset index rather than walked.
+	constexpr auto linesToWalk = 64;
+	auto linesWalked = 0;
+	auto useIndex = [&]
+	{
+		return args.currentMode == Editor::Mode::Normal && linesWalked++ >= linesToWalk;
+	};
+	auto atStop = [&](std::int64_t stop)
+	{
+		auto line = args.offsets.lineAtStop(stop);
+		auto skip = stop - args.offsets.start(line).stops;
+		assert(skip >= 0 && skip <= std::numeric_limits<int>::max());
+		return CursorPosition{
+			.line=line, .col=columnAfter(args.buffer.getLineText(line), 0, static_cast<int>(skip))};
+	};
+
+	// a step off the end of a line goes on to the next one
 	switch (args.key)
 	{
 		case ' ':
 		case ncurses::Key::Right:
-			while (toMove)
+			while (toMove > 0)
 			{
-				auto lastValidPosOnLine = lastValidOffset(cursor.line);
-				if (cursor.col + toMove <= lastValidPosOnLine)
+				if (cursor.col == 0 && useIndex())
 				{
-					cursor.col += toMove;
+					auto last = args.offsets.start(args.buffer.numLines()).stops - 1;
+					cursor = atStop(std::min(args.offsets.start(cursor.line).stops + toMove, last));
 					break;
 				}
-				else if (cursor.line < args.buffer.numLines() - 1)
+				auto text = args.buffer.getLineText(cursor.line);
+				auto lastValidPosOnLine = lastValidOffset(cursor.line);
+				for (; toMove > 0 && cursor.col < lastValidPosOnLine; toMove--)
 				{
-					toMove -= lastValidPosOnLine - cursor.col + 1;
-					cursor.col = 0;
-					cursor.line++;
+					cursor.col = static_cast<int>(nextCharacter(text, static_cast<std::size_t>(cursor.col)));
 				}
-				else
+				if (toMove == 0 || cursor.line == args.buffer.numLines() - 1)
 				{
-					cursor.col = lastValidPosOnLine;
 					break;
 				}
+				toMove--;
+				cursor.col = 0;
+				cursor.line++;
 			}
 			break;
 
 		case ncurses::Key::Backspace:
 		case ncurses::Key::Left:
-			while (toMove)
+			while (toMove > 0)
 			{
-				if (cursor.col >= toMove)
+				if (cursor.col == lastValidOffset(cursor.line) && useIndex())
 				{
-					cursor.col -= toMove;
+					auto end = args.offsets.start(cursor.line + 1).stops - 1;
+					cursor = atStop(std::max(end - toMove, std::int64_t{0}));
 					break;
 				}
-				else if (cursor.line > 0)
+				auto text = args.buffer.getLineText(cursor.line);
+				for (; toMove > 0 && cursor.col > 0; toMove--)
 				{
-					toMove -= cursor.col + 1;
-					cursor.line--;
-					cursor.col = std::max(0, lastValidOffset(cursor.line));
+					cursor.col = static_cast<int>(previousCharacter(text, static_cast<std::size_t>(cursor.col)));
 				}
-				else
+				if (toMove == 0 || cursor.line == 0)
 				{
-					cursor.col = 0;
 					break;
 				}
+				toMove--;
+				cursor.line--;
+				cursor.col = lastValidOffset(cursor.line);
 			}
-			
 			break;
 
 		case '$':
@@ -97,13 +153,26 @@
 			cursor.line = std::min(args.count.value_or(args.buffer.numLines()) - 1, args.buffer.numLines() - 1);
 			break;
 
+		// N% goes to the line holding the byte N percent of the way into the
+		// file, as less does
+		case '%':
+		{
+			if (not args.count.has_value())
+			{
+				return {};
+			}
+			auto total = args.offsets.start(args.buffer.numLines()).bytes;
+			auto byte = total * std::min(*args.count, 100) / 100;
+			cursor.line = std::min(args.offsets.lineAtByte(byte), args.buffer.numLines() - 1);
+			break;
+		}
+
 		case 'h':
-			cursor.line = args.windowInfo.topLine;
+			cursor.line = std::min(args.layout.topLine, args.buffer.numLines() - 1);
 			break;
 
 		case 'l':
-			// FIXME get actual lowest visible line
-			cursor.line = std::min(args.windowInfo.topLine + 22, args.buffer.numLines() - 1);
+			cursor.line = std::min(args.layout.bottomLine, args.buffer.numLines() - 1);
 			break;
 
 		case 'b':
@@ -121,15 +190,250 @@
 		default:
 			throw;
 	}
-	int cursorLineLength = args.buffer.lineLength(cursor.line);
-	if (cursor.col > cursorLineLength)
+	cursor.col = columnOnLine(args.buffer, cursor.line, cursor.col);
+
+	return {.cursorMoved=true, .cursorPosition=cursor};
+}
+
+// Last line shown in full when the screen starts at topLine.
+int bottomLineFrom(OperatorArgs const& args, int topLine)
+{
+	auto rows = args.heights.height(topLine);
+	auto line = topLine;
+	while (line < args.buffer.numLines() - 1)
+	{
+		rows += args.heights.height(line + 1);
+		if (rows > static_cast<int>(args.layout.rows.size()))
+		{
+			break;
+		}
+		line++;
+	}
+	return line;
+}
+
+[[nodiscard]] OperatorResult scrollScreen(OperatorArgs args)
+{
+	if (args.buffer.isEmpty())
+	{
+		return {};
+	}
+
+	auto screenHeight = static_cast<int>(args.layout.rows.size());
+	auto lastLine = args.buffer.numLines() - 1;
+	auto forward = args.key == ncurses::Key::Ctrl({'f'}) || args.key == ncurses::Key::Ctrl({'d'});
+	auto rows = 0;
+	if (args.key == ncurses::Key::Ctrl({'f'}) || args.key == ncurses::Key::Ctrl({'b'}))
+	{
+		rows = args.count.value_or(1) * std::max(1, screenHeight - 2);
+	}
+	else if (args.key == ncurses::Key::Ctrl({'d'}) || args.key == ncurses::Key::Ctrl({'u'}))
+	{
+		rows = args.count.value_or(std::max(1, screenHeight / 2));
+	}
+	else
+	{
+		throw;
+	}
+
+	auto windowInfo = args.windowInfo;
+	auto& top = windowInfo.topLine;
+	if (forward && rows < screenHeight)
+	{
+		// the new top line is already on screen, no need to measure anything
+		auto [line, segment] = args.layout.rows[static_cast<std::size_t>(rows)];
+		top = line < 0 ? lastLine : std::min(line + (segment > 0 ? 1 : 0), lastLine);
+	}
+	else if (forward)
+	{
+		for (auto scrolled = 0; top < lastLine && scrolled + args.heights.height(top) <= rows; top++)
+		{
+			scrolled += args.heights.height(top);
+		}
+	}
+	else
+	{
+		for (auto scrolled = 0; top > 0 && scrolled + args.heights.height(top - 1) <= rows; top--)
+		{
+			scrolled += args.heights.height(top - 1);
+		}
+	}
+	if (top == args.windowInfo.topLine)
+	{
+		// a line taller than the scroll amount still has to move
+		top = std::clamp(top + (forward ? 1 : -1), 0, lastLine);
+	}
+
+	auto cursor = args.cursor;
+	if (args.key == ncurses::Key::Ctrl({'f'}))
+	{
+		cursor.line = top;
+	}
+	else if (args.key == ncurses::Key::Ctrl({'b'}))
+	{
+		cursor.line = bottomLineFrom(args, top);
+	}
+	else
+	{
+		cursor.line += top - args.windowInfo.topLine;
+	}
+	cursor.line = std::clamp(cursor.line, top, bottomLineFrom(args, top));
+	cursor.col = columnOnLine(args.buffer, cursor.line, cursor.col);
+
+	return {.cursorMoved=true, .cursorPosition=cursor, .viewportMoved=true, .windowInfo=windowInfo};
+}
+
+// A line break is a blank between words, and an empty line is a word of its
+// own to w and B; e passes over empty lines.
+std::optional<CursorPosition> nextWordStart(Editor::Buffer const& buffer, CursorPosition p, WordKind kind)
+{
+	auto const& text = buffer.getLine(p.line);
+	if (auto start = findWordStart(text, nextCharacter(text, static_cast<std::size_t>(p.col)), kind); start.has_value())
+	{
+		return CursorPosition{.line=p.line, .col=static_cast<int>(*start)};
+	}
+	for (auto line = p.line + 1; line < buffer.numLines(); line++)
+	{
+		auto const& lineText = buffer.getLine(line);
+		if (lineText.empty())
+		{
+			return CursorPosition{.line=line, .col=0};
+		}
+		if (auto start = findWordStart(lineText, 0, kind); start.has_value())
+		{
+			return CursorPosition{.line=line, .col=static_cast<int>(*start)};
+		}
+	}
+	return std::nullopt;
+}
+
+std::optional<CursorPosition> nextWordEnd(Editor::Buffer const& buffer, CursorPosition p, WordKind kind)
+{
+	for (auto line = p.line; line < buffer.numLines(); line++)
+	{
+		auto const& text = buffer.getLine(line);
+		auto from = line == p.line ? nextCharacter(text, static_cast<std::size_t>(p.col)) : 0;
+		if (auto end = findWordEnd(text, from, kind); end.has_value())
+		{
+			return CursorPosition{.line=line, .col=static_cast<int>(characterStart(text, *end))};
+		}
+	}
+	return std::nullopt;
+}
+
+std::optional<CursorPosition> previousWordStart(Editor::Buffer const& buffer, CursorPosition p, WordKind kind)
+{
+	auto const& text = buffer.getLine(p.line);
+	if (auto start = findWordStartBefore(text, static_cast<std::size_t>(p.col), kind); start.has_value())
+	{
+		return CursorPosition{.line=p.line, .col=static_cast<int>(*start)};
+	}
+	for (auto line = p.line - 1; line >= 0; line--)
+	{
+		auto const& lineText = buffer.getLine(line);
+		if (lineText.empty())
+		{
+			return CursorPosition{.line=line, .col=0};
+		}
+		if (auto start = findWordStartBefore(lineText, lineText.length(), kind); start.has_value())
+		{
+			return CursorPosition{.line=line, .col=static_cast<int>(*start)};
+		}
+	}
+	return std::nullopt;
+}
+
+[[nodiscard]] OperatorResult moveByWords(OperatorArgs args)
+{
+	if (args.buffer.isEmpty())
+	{
+		return {};
+	}
+
+	auto kind = args.key == 'W' || args.key == 'E' || args.key == 'B' ? WordKind::BigWord : WordKind::Word;
+	auto step = std::optional<CursorPosition>(args.cursor);
+	auto cursor = args.cursor;
+	for (auto count = args.count.value_or(1); count > 0 && step.has_value(); count--)
+	{
+		cursor = *step;
+		switch (args.key)
+		{
+			case 'w':
+			case 'W':
+				step = nextWordStart(args.buffer, cursor, kind);
+				break;
+
+			case 'e':
+			case 'E':
+				step = nextWordEnd(args.buffer, cursor, kind);
+				break;
+
+			case 'B':
+				step = previousWordStart(args.buffer, cursor, kind);
+				break;
+
+			default:
+				throw;
+		}
+	}
+	if (step.has_value())
+	{
+		cursor = *step;
+	}
+	else if (args.key == 'B')
+	{
+		cursor = {.line=0, .col=0};
+	}
+	else
 	{
-		cursor.col = std::max(0, cursorLineLength - 1);
+		// no more words: the end of the last line
+		auto const& text = args.buffer.getLine(args.buffer.numLines() - 1);
+		cursor = {.line=args.buffer.numLines() - 1, .col=static_cast<int>(previousCharacter(text, text.length()))};
 	}
 
 	return {.cursorMoved=true, .cursorPosition=cursor};
 }
 
+// Paragraphs are separated by empty lines.  } and { go to the next empty line
+// after the paragraph, or before it, or to the end of the file.
+[[nodiscard]] OperatorResult moveByParagraphs(OperatorArgs args)
+{
+	if (args.buffer.isEmpty())
+	{
+		return {};
+	}
+
+	auto forward = args.key == '}';
+	if (not forward && args.key != '{')
+	{
+		throw;
+	}
+	auto step = forward ? 1 : -1;
+	auto lastLine = args.buffer.numLines() - 1;
+	auto atEnd = [&](int line) { return forward ? line >= lastLine : line <= 0; };
+
+	auto line = args.cursor.line;
+	for (auto count = args.count.value_or(1); count > 0 && not atEnd(line); count--)
+	{
+		// off the empty lines the cursor may be on, then through the paragraph
+		while (not atEnd(line) && args.buffer.lineLength(line) == 0)
+		{
+			line += step;
+		}
+		while (not atEnd(line) && args.buffer.lineLength(line) != 0)
+		{
+			line += step;
+		}
+	}
+
+	auto cursor = CursorPosition{.line=line, .col=0};
+	if (forward && args.buffer.lineLength(line) != 0)
+	{
+		auto const& text = args.buffer.getLine(line);
+		cursor.col = static_cast<int>(previousCharacter(text, text.length()));
+	}
+	return {.cursorMoved=true, .cursorPosition=cursor};
+}
 
 [[nodiscard]] OperatorResult moveToStartOfLine(OperatorArgs args)
 {
@@ -202,17 +506,18 @@
 			}
 			else
 			{
-				args.buffer.erase(args.cursor, args.count.value_or(1));
-				int cursorLineLength = args.buffer.lineLength(args.cursor.line);
-				if (cursorLineLength == 0)
+				auto end = columnAfter(args.buffer.getLineText(args.cursor.line), args.cursor.col, args.count.value_or(1));
+				args.buffer.erase(args.cursor, end - args.cursor.col);
+				auto text = args.buffer.getLineText(args.cursor.line);
+				if (text.length() == 0)
 				{
 					result.cursorMoved = true;
 					result.cursorPosition = {.line=args.cursor.line, .col=0};
 				}
-				else if (args.cursor.col >= cursorLineLength)
+				else if (static_cast<std::size_t>(args.cursor.col) >= text.length())
 				{
 					result.cursorMoved = true;
-					result.cursorPosition = {.line=args.cursor.line, .col=args.cursor.col - 1};
+					result.cursorPosition = {.line=args.cursor.line, .col=static_cast<int>(previousCharacter(text, text.length()))};
 				}
 			}
 			break;
@@ -220,9 +525,10 @@
 		case ncurses::Key::Backspace:
 			if (args.cursor.col > 0)
 			{
+				auto previous = previousCharacter(args.buffer.getLineText(args.cursor.line), static_cast<std::size_t>(args.cursor.col));
 				result.cursorMoved = true;
-				result.cursorPosition = {.line=args.cursor.line, .col=args.cursor.col - 1};
-				args.buffer.erase(result.cursorPosition, 1);
+				result.cursorPosition = {.line=args.cursor.line, .col=static_cast<int>(previous)};
+				args.buffer.erase(result.cursorPosition, args.cursor.col - result.cursorPosition.col);
 			}
 			else if (args.cursor.line > 0)
 			{
@@ -278,7 +584,7 @@
 	if (result.cursorPosition.col >= args.buffer.lineLength(result.cursorPosition.line))
 	{
 		result.cursorMoved = true;
-		result.cursorPosition.col = std::max(0, args.buffer.lineLength(result.cursorPosition.line) - 1);
+		result.cursorPosition.col = columnOnLine(args.buffer, result.cursorPosition.line, std::max(0, args.buffer.lineLength(result.cursorPosition.line) - 1));
 	}
 
 	return result;
@@ -358,23 +664,92 @@
 		return {};
 	}
 
-	if (args.key != 'r')
+	if (args.pendingOperator == ncurses::Key::Null)
+	{
+		return {.pendingOperator=args.key, .count=args.count};
+	}
+	if (args.pendingOperator != 'r')
 	{
 		throw;
 	}
-	auto ch = args.context.getch();
-	assert(ch < 256);  // valid char
+	// only by ASCII, as a character of more bytes would come a byte at a time
+	if (args.key.keycode >= 0200 || args.key == ncurses::Key::Escape)
+	{
+		return {};
+	}
 
-	auto c = static_cast<char>(ch);
-	auto count = std::min(args.count.value_or(1), args.buffer.lineLength(args.cursor.line) - args.cursor.col);
-	args.buffer.erase(args.cursor, count);
+	auto c = static_cast<char>(args.key.keycode);
+	auto text = args.buffer.getLineText(args.cursor.line);
+	auto end = static_cast<std::size_t>(args.cursor.col);
+	auto count = 0;
+	for (; count < args.count.value_or(1) && end < text.length(); count++)
+	{
+		end = nextCharacter(text, end);
+	}
+	if (count == 0)
+	{
+		return {};
+	}
+	args.buffer.erase(args.cursor, static_cast<int>(end) - args.cursor.col);
 	args.buffer.insert(args.cursor, c, count);
 	return {.bufferChanged=true};
 }
 
-[[nodiscard]] OperatorResult redraw(OperatorArgs)
+[[nodiscard]] OperatorResult setMark(OperatorArgs args)
+{
+	if (args.buffer.isEmpty())
+	{
+		return {};
+	}
+
+	if (args.pendingOperator == ncurses::Key::Null)
+	{
+		return {.pendingOperator=args.key};
+	}
+	if (args.key.keycode < 'a' || args.key.keycode > 'z')
+	{
+		return {};
+	}
+	args.marks.set(args.key.keycode, args.cursor.line);
+	return {};
+}
+
+[[nodiscard]] OperatorResult goToMark(OperatorArgs args)
+{
+	if (args.pendingOperator == ncurses::Key::Null)
+	{
+		return {.pendingOperator=args.key};
+	}
+	if (args.key.keycode < 'a' || args.key.keycode > 'z')
+	{
+		return {};
+	}
+	auto line = args.marks.line(args.key.keycode);
+	if (not line.has_value())
+	{
+		return {.message="ERR: Mark not set"};
+	}
+	return {.cursorMoved=true, .cursorPosition={.line=*line, .col=0}};
+}
+
+[[nodiscard]] OperatorResult redraw(OperatorArgs args)
 {
-	return {.bufferChanged=true};  // LIES!
+	auto windowInfo = args.windowInfo;
+	if (args.buffer.isEmpty())
+	{
+		return {.viewportMoved=true, .windowInfo=windowInfo};
+	}
+
+	// put the cursor line in the middle of the screen
+	auto screenHeight = static_cast<int>(args.layout.rows.size());
+	auto rowsAbove = (screenHeight - args.heights.height(args.cursor.line)) / 2;
+	windowInfo.topLine = args.cursor.line;
+	while (windowInfo.topLine > 0 && args.heights.height(windowInfo.topLine - 1) <= rowsAbove)
+	{
+		windowInfo.topLine--;
+		rowsAbove -= args.heights.height(windowInfo.topLine);
+	}
+	return {.viewportMoved=true, .windowInfo=windowInfo};
 }
 
 [[nodiscard]] OperatorResult startInsert(OperatorArgs args)
@@ -395,8 +770,9 @@
 			if (args.buffer.lineLength(args.cursor.line) > 0)
 			{
 				// if the line is not empty, we're guaranteed that the column after the cursor is a valid spot
+				auto next = nextCharacter(args.buffer.getLineText(args.cursor.line), static_cast<std::size_t>(args.cursor.col));
 				result.cursorMoved = true;
-				result.cursorPosition = {.line=args.cursor.line, .col=args.cursor.col + 1};
+				result.cursorPosition = {.line=args.cursor.line, .col=static_cast<int>(next)};
 			}
 			break;
 
@@ -423,8 +799,9 @@
 
 [[nodiscard]] OperatorResult startNormal(OperatorArgs args)
 {
+	auto col = args.buffer.isEmpty() ? 0 : previousCharacter(args.buffer.getLineText(args.cursor.line), static_cast<std::size_t>(args.cursor.col));
 	return {
-		.cursorMoved=true, .cursorPosition={args.cursor.line, std::max(args.cursor.col-1, 0)},
+		.cursorMoved=true, .cursorPosition={args.cursor.line, static_cast<int>(col)},
 		.modeChanged=true, .newMode=Editor::Mode::Normal
 	};
 }
@@ -12,13 +12,15 @@ struct OperatorArgs
 {
 	ncurses::Key const key;
 
-	ncurses::Ncurses& context;
-
 	Editor::Buffer& buffer;
 	Editor::Register& reg;
 
 	CursorPosition const cursor;
 	WindowInfo const windowInfo;
+	FrameLayout const& layout;
+	Editor::HeightIndex const& heights;
+	Editor::OffsetIndex const& offsets;
+	Editor::MarkIndex& marks;
 	Editor::Mode const currentMode;
 
 	ncurses::Key pendingOperator{ncurses::Key::Null};
@@ -30,6 +32,9 @@ struct OperatorResult
 	bool cursorMoved{false};
 	CursorPosition cursorPosition{0, 0};
 
+	bool viewportMoved{false};
+	WindowInfo windowInfo{0, 0};
+
 	bool bufferChanged{false};
 
 	bool modeChanged{false};
@@ -45,6 +50,9 @@ using OperatorFunction = OperatorResult(*)(OperatorArgs args);
 
 OperatorResult moveCursor(OperatorArgs args);
 OperatorResult scrollBuffer(OperatorArgs args);
+OperatorResult scrollScreen(OperatorArgs args);
+OperatorResult moveByWords(OperatorArgs args);
+OperatorResult moveByParagraphs(OperatorArgs args);
 OperatorResult moveToStartOfLine(OperatorArgs args);
 OperatorResult handleDigit(OperatorArgs args);
 OperatorResult deleteChars(OperatorArgs args);
@@ -54,7 +62,9 @@ OperatorResult yankLines(OperatorArgs args);
 OperatorResult doPendingOperator(OperatorArgs args);
 OperatorResult putLines(OperatorArgs args);
 OperatorResult replaceChars(OperatorArgs args);
-OperatorResult redraw(OperatorArgs);
+OperatorResult setMark(OperatorArgs args);
+OperatorResult goToMark(OperatorArgs args);
+OperatorResult redraw(OperatorArgs args);
 OperatorResult startInsert(OperatorArgs args);
 OperatorResult startCommand(OperatorArgs);
 OperatorResult startNormal(OperatorArgs args);
@@ -76,17 +86,31 @@ static auto normalOps = std::unordered_map<ncurses::Key, OperatorFunction>{
 	{ncurses::Key::Left, moveCursor},
 	{ncurses::Key{'$'}, moveCursor},
 	{ncurses::Key::End, moveCursor},
+	{ncurses::Key{'w'}, moveByWords},
+	{ncurses::Key{'W'}, moveByWords},
+	{ncurses::Key{'e'}, moveByWords},
+	{ncurses::Key{'E'}, moveByWords},
+	{ncurses::Key{'B'}, moveByWords},  // b already goes to the top
+	{ncurses::Key{'{'}, moveByParagraphs},
+	{ncurses::Key{'}'}, moveByParagraphs},
 	{ncurses::Key{'g'}, scrollBuffer},
+	{ncurses::Key{'%'}, scrollBuffer},
 	{ncurses::Key{'h'}, scrollBuffer},
 	{ncurses::Key{'l'}, scrollBuffer},
 	{ncurses::Key{'b'}, scrollBuffer},
 	{ncurses::Key::Down, scrollBuffer},
 	{ncurses::Key::Up, scrollBuffer},
+	{ncurses::Key::Ctrl({'f'}), scrollScreen},
+	{ncurses::Key::Ctrl({'b'}), scrollScreen},
+	{ncurses::Key::Ctrl({'d'}), scrollScreen},
+	{ncurses::Key::Ctrl({'u'}), scrollScreen},
 	{ncurses::Key::Enter, moveToStartOfLine},
 	{ncurses::Key{'-'}, moveToStartOfLine},
 	{ncurses::Key::Home, moveToStartOfLine},
 	{ncurses::Key{'x'}, deleteChars},
-	{ncurses::Key{'r'}, replaceChars},  // any character
+	{ncurses::Key{'r'}, replaceChars},  // r and any character
+	{ncurses::Key{'m'}, setMark},  // m and a letter
+	{ncurses::Key{'\''}, goToMark},  // ' and a letter
 	{ncurses::Key{'d'}, doPendingOperator},   // dd or dy (delete / cut)
 	{ncurses::Key{'y'}, doPendingOperator},     // yy or yd (yank / cut)
 	{ncurses::Key{'p'}, putLines},
@@ -0,0 +1,205 @@
+#include "renderer.h"
+
+#include <array>
+#include <cassert>
+#include <charconv>
+#include <limits>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include <signal.h>
+
+#include "ncursespp/color.h"
+
+
+Renderer::Renderer(
+	ncurses::Window& editorWindow_, ncurses::Window& lineNumbers_, ncurses::Window& statusLine_,
+	std::mutex& cursesMutex_
+)
+	: editorWindow{editorWindow_}
+	, lineNumbers{lineNumbers_}
+	, statusLine{statusLine_}
+	, cursesMutex{cursesMutex_}
+{
+	// SIGWINCH has to interrupt the input thread's wait for input, so this
+	// thread must not be the one to take it
+	auto resizeSignal = sigset_t{};
+	sigemptyset(&resizeSignal);
+	sigaddset(&resizeSignal, SIGWINCH);
+	auto previousMask = sigset_t{};
+	pthread_sigmask(SIG_BLOCK, &resizeSignal, &previousMask);
+	thread = std::jthread{[this](std::stop_token stop) { run(stop); }};
+	pthread_sigmask(SIG_SETMASK, &previousMask, nullptr);
+}
+
+void Renderer::submit(Frame frame)
+{
+	{
+		auto lock = std::lock_guard{frameMutex};
+		pendingFrame = std::move(frame);
+	}
+	frameSubmitted.notify_one();
+}
+
+void Renderer::invalidate()
+{
+	drawnLayout = {};
+	drawnGutterWidth = 0;
+}
+
+void Renderer::run(std::stop_token stop)
+{
+	auto const frameInterval = std::chrono::steady_clock::duration{std::chrono::seconds{1}} / maxFramesPerSecond;
+	auto lastFrameTime = std::chrono::steady_clock::time_point{};
+	while (true)
+	{
+		{
+			auto lock = std::unique_lock{frameMutex};
+			if (not frameSubmitted.wait(lock, stop, [this] { return pendingFrame.has_value(); }))
+			{
+				return;
+			}
+		}
+
+		// anything submitted while we wait takes the place of this frame
+		std::this_thread::sleep_until(lastFrameTime + frameInterval);
+
+		auto frame = Frame{};
+		{
+			auto lock = std::lock_guard{frameMutex};
+			frame = std::move(*pendingFrame);
+			pendingFrame.reset();
+		}
+		{
+			auto lock = std::lock_guard{cursesMutex};
+			draw(frame);
+		}
+		lastFrameTime = std::chrono::steady_clock::now();
+	}
+}
+
+void Renderer::draw(Frame const& frame)
+{
+	editorWindow.erase();
+
+	assert(frame.text.size() == frame.layout.rows.size());
+	for (auto y = 0; auto [i, segment]: frame.layout.rows)
+	{
+		auto const& text = frame.text[static_cast<std::size_t>(y)];
+		if (i < 0)
+		{
+			editorWindow.mvaddstr({0, y}, "~");
+		}
+		else if (segment == 0)
+		{
+			// text that is not wrapped already stops at the right edge; cutting
+			// it at a count of bytes would split characters
+			editorWindow.mvaddstr({0, y}, text);
+		}
+		y++;
+	}
+
+	drawStyles(frame);
+
+	drawLineNumbers(frame.layout);
+	drawnLayout = frame.layout;
+
+	statusLine.erase();
+	statusLine.mvaddstr({frame.statusCol, 0}, frame.status);
+
+	// the window refreshed last leaves the terminal cursor where it wants it
+	if (frame.cursorOnStatusLine)
+	{
+		editorWindow.refresh();
+		statusLine.move(frame.cursor);
+		statusLine.refresh();
+	}
+	else
+	{
+		statusLine.refresh();
+		editorWindow.move(frame.cursor);
+		editorWindow.refresh();
+	}
+}
+
+ncurses::Color colorOf(Style style)
+{
+	switch (style)
+	{
+		case Style::Keyword:
+		case Style::Warning:
+			return ncurses::Color::Yellow;
+		case Style::Type:
+		case Style::Info:
+			return ncurses::Color::Green;
+		case Style::String:
+		case Style::Number:
+			return ncurses::Color::Magenta;
+		case Style::Comment:
+			return ncurses::Color::Cyan;
+		case Style::Preprocessor:
+			return ncurses::Color::Blue;
+		case Style::Error:
+			return ncurses::Color::Red;
+		case Style::Debug:
+			return ncurses::Color::Gray;
+		case Style::Plain:
+			break;
+	}
+	return ncurses::Color::White;
+}
+
+// Coloured pieces are drawn again over the plain text, each where it already
+// is; a wrapped line carries them on to the rows below its first.
+void Renderer::drawStyles(Frame const& frame)
+{
+	auto width = editorWindow.get_rect().s.w;
+	auto height = static_cast<int>(frame.layout.rows.size());
+	assert(frame.styles.size() == frame.layout.rows.size());
+	for (auto y = 0; y < height; y++)
+	{
+		auto const& text = frame.text[static_cast<std::size_t>(y)];
+		for (auto [offset, length, column, style]: frame.styles[static_cast<std::size_t>(y)])
+		{
+			auto piece = std::string_view{text}.substr(offset, length);
+			editorWindow.setcolor(colorOf(style), ncurses::Color::Black);
+			if (frame.wrap && width > 0 && y + column / width < height)
+			{
+				editorWindow.mvaddstr({column % width, y + column / width}, piece);
+			}
+			else if (not frame.wrap && column < width)
+			{
+				editorWindow.mvaddstr({column, y}, piece);
+			}
+		}
+	}
+	editorWindow.setcolor(ncurses::Color::White, ncurses::Color::Black);
+}
+
+// The gutter only changes when different lines come into view or it gets
+// wider, so it is left alone otherwise.
+void Renderer::drawLineNumbers(FrameLayout const& layout)
+{
+	auto gutterWidth = lineNumbers.get_rect().s.w;
+	if (gutterWidth == drawnGutterWidth && layout.rows == drawnLayout.rows)
+	{
+		return;
+	}
+
+	lineNumbers.erase();
+	auto number = std::array<char, std::numeric_limits<int>::digits10 + 1>{};
+	for (auto y = 0; auto [i, segment]: layout.rows)
+	{
+		if (i >= 0 && segment == 0)
+		{
+			auto [end, error] = std::to_chars(number.data(), number.data() + number.size(), i + 1);
+			assert(error == std::errc{});
+			auto length = static_cast<int>(end - number.data());
+			lineNumbers.mvaddnstr({gutterWidth - 1 - length, y}, {number.data(), end}, gutterWidth - 1);
+		}
+		y++;
+	}
+	lineNumbers.refresh();
+	drawnGutterWidth = gutterWidth;
+}
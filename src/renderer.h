@@ -0,0 +1,98 @@
+#ifndef SRC_RENDERER_H_
+#define SRC_RENDERER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ncursespp/geometry.h"
+#include "ncursespp/window.h"
+
+#include "highlighter.h"
+
+// Which buffer line each screen row shows, so that motions relative to the
+// screen don't have to measure lines again.
+struct FrameLayout
+{
+	struct Row
+	{
+		int line;  // -1 past the end of the buffer
+		int segment;  // which wrapped piece of the line
+
+		bool operator==(Row const&) const = default;
+	};
+	std::vector<Row> rows{};
+
+	int topLine{0};
+	int bottomLine{0};  // last line shown in full
+};
+
+// Everything needed to draw the screen, copied out of the editor so that the
+// render thread never looks at the buffer.
+struct Frame
+{
+	FrameLayout layout{};
+	std::vector<std::string> text{};  // for each row where a line starts, as much of it as fits
+	// Pieces of that text drawn in colour, at the screen columns they start at,
+	// counted along the line from the start of its row.
+	struct StyledSpan
+	{
+		std::size_t offset;
+		std::size_t length;
+		int column;
+		Style style;
+	};
+	std::vector<std::vector<StyledSpan>> styles{};
+	bool wrap{true};
+
+	std::string status{};
+	int statusCol{0};
+
+	ncurses::Point cursor{};
+	bool cursorOnStatusLine{false};
+};
+
+// Draws frames on a thread of its own, at most maxFramesPerSecond of them; a
+// frame submitted before the previous one was drawn replaces it.  All curses
+// calls, here and elsewhere, are made holding the curses mutex.
+class Renderer
+{
+public:
+	Renderer(
+		ncurses::Window& editorWindow, ncurses::Window& lineNumbers, ncurses::Window& statusLine,
+		std::mutex& cursesMutex
+	);
+
+	void submit(Frame);
+	void invalidate();  // the windows were replaced; call holding the curses mutex
+
+	static constexpr auto maxFramesPerSecond = 60;
+
+private:
+	void run(std::stop_token);
+	void draw(Frame const&);
+	void drawStyles(Frame const&);
+	void drawLineNumbers(FrameLayout const&);
+
+	ncurses::Window& editorWindow;
+	ncurses::Window& lineNumbers;
+	ncurses::Window& statusLine;
+	std::mutex& cursesMutex;
+
+	std::mutex frameMutex{};
+	std::condition_variable_any frameSubmitted{};
+	std::optional<Frame> pendingFrame{};
+
+	// what is on screen now, guarded by the curses mutex
+	FrameLayout drawnLayout{};
+	int drawnGutterWidth{0};
+
+	std::jthread thread{};  // last, so that it stops before the rest goes away
+};
+
+#endif // SRC_RENDERER_H_
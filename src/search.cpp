@@ -0,0 +1,138 @@
+#include "search.h"
+
+#include <cctype>
+
+Pattern::Pattern(std::string_view pattern)
+	: source{pattern}
+	, literal{pattern.find_first_of(".[]*^$\\") == std::string_view::npos}
+{
+	if (literal)
+	{
+		return;
+	}
+	if (auto result = regcomp(&compiled, source.c_str(), 0); result != 0)
+	{
+		errorMessage.resize(regerror(result, &compiled, nullptr, 0));
+		regerror(result, &compiled, errorMessage.data(), errorMessage.size());
+		errorMessage.resize(errorMessage.find('\0'));
+		return;
+	}
+	compiledOk = true;
+}
+
+Pattern::~Pattern()
+{
+	if (compiledOk)
+	{
+		regfree(&compiled);
+	}
+}
+
+bool Pattern::isValid() const
+{
+	return literal || compiledOk;
+}
+
+std::string const& Pattern::error() const
+{
+	return errorMessage;
+}
+
+std::string const& Pattern::text() const
+{
+	return source;
+}
+
+std::optional<Pattern::Match> Pattern::find(std::string_view line, std::size_t from) const
+{
+	if (from > line.length())
+	{
+		return std::nullopt;
+	}
+	if (literal)
+	{
+		auto pos = line.find(source, from);
+		if (pos == std::string_view::npos)
+		{
+			return std::nullopt;
+		}
+		return Match{.offset=pos, .length=source.length()};
+	}
+
+	// REG_STARTEND bounds the match by the offsets given rather than a '\0'
+	auto match = regmatch_t{.rm_so=static_cast<regoff_t>(from), .rm_eo=static_cast<regoff_t>(line.length())};
+	if (regexec(&compiled, line.data(), 1, &match, REG_STARTEND | (from > 0 ? REG_NOTBOL : 0)) != 0)
+	{
+		return std::nullopt;
+	}
+	return Match{
+		.offset=static_cast<std::size_t>(match.rm_so),
+		.length=static_cast<std::size_t>(match.rm_eo - match.rm_so)
+	};
+}
+
+std::optional<Pattern::Match> Pattern::find(
+	std::string_view line, std::size_t from, std::array<Match, maxGroups>& groups) const
+{
+	groups.fill({.offset=0, .length=0});
+	if (literal || from > line.length())
+	{
+		return find(line, from);
+	}
+
+	auto matches = std::array<regmatch_t, maxGroups + 1>{};
+	matches[0] = {.rm_so=static_cast<regoff_t>(from), .rm_eo=static_cast<regoff_t>(line.length())};
+	if (regexec(&compiled, line.data(), matches.size(), matches.data(), REG_STARTEND | (from > 0 ? REG_NOTBOL : 0)) != 0)
+	{
+		return std::nullopt;
+	}
+	for (auto i = std::size_t{0}; i < maxGroups; i++)
+	{
+		if (auto& group = matches[i + 1]; group.rm_so >= 0)
+		{
+			groups[i] = {
+				.offset=static_cast<std::size_t>(group.rm_so),
+				.length=static_cast<std::size_t>(group.rm_eo - group.rm_so)
+			};
+		}
+	}
+	return Match{
+		.offset=static_cast<std::size_t>(matches[0].rm_so),
+		.length=static_cast<std::size_t>(matches[0].rm_eo - matches[0].rm_so)
+	};
+}
+
+bool Pattern::matches(std::string_view line) const
+{
+	return find(line).has_value();
+}
+
+bool isPatternDelimiter(char c)
+{
+	return std::ispunct(static_cast<unsigned char>(c)) and c != '\\';
+}
+
+std::string takeDelimited(std::string_view& text, char delimiter)
+{
+	auto result = std::string{};
+	while (not text.empty() and text.front() != delimiter)
+	{
+		if (text.front() == '\\' and text.length() > 1)
+		{
+			if (text[1] != delimiter)
+			{
+				result += '\\';
+			}
+			result += text[1];
+			text.remove_prefix(2);
+			continue;
+		}
+		result += text.front();
+		text.remove_prefix(1);
+	}
+	if (not text.empty())
+	{
+		text.remove_prefix(1);
+	}
+	return result;
+}
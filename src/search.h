@@ -0,0 +1,59 @@
+#ifndef SRC_SEARCH_H_
+#define SRC_SEARCH_H_
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <regex.h>
+
+// A search pattern: a POSIX basic regular expression, as in ex.  One without
+// any special characters is looked for as plain text, which is much faster.
+// Matching does not change the pattern, so one may be used from several
+// threads at once, but they take turns: regexec locks the compiled expression.
+// Threads matching in parallel should each compile the pattern for themselves.
+class Pattern
+{
+public:
+	explicit Pattern(std::string_view);
+	~Pattern();
+	Pattern(Pattern const&) = delete;
+	Pattern& operator=(Pattern const&) = delete;
+
+	bool isValid() const;
+	std::string const& error() const;
+	std::string const& text() const;
+
+	struct Match
+	{
+		std::size_t offset;
+		std::size_t length;
+	};
+	// The first match starting at or after `from`; `line` is the whole line,
+	// so that ^ only matches at its start.
+	std::optional<Match> find(std::string_view line, std::size_t from = 0) const;
+	bool matches(std::string_view line) const;
+
+	// Also gives what the parenthesised subexpressions matched, \1 to \9;
+	// those that took no part in the match come out empty.
+	static constexpr auto maxGroups = std::size_t{9};
+	std::optional<Match> find(std::string_view line, std::size_t from, std::array<Match, maxGroups>& groups) const;
+
+private:
+	std::string source;
+	bool literal;
+	regex_t compiled{};
+	bool compiledOk{false};
+	std::string errorMessage{};
+};
+
+// Commands such as :s and :g take patterns between delimiters, which may be
+// any punctuation but a backslash.  takeDelimited splits off the text up to the
+// next unescaped delimiter, leaving `text` just past it; an escaped delimiter
+// stands for itself.
+bool isPatternDelimiter(char);
+std::string takeDelimited(std::string_view& text, char delimiter);
+
+#endif // SRC_SEARCH_H_
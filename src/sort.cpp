@@ -0,0 +1,246 @@
+#include "editor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <span>
+#include <unordered_set>
+
+// The text from the start of blank-separated field `field`, counted from 1, to
+// the end of the line; field 0 is the whole line.
+std::string_view sortKeyOf(std::string_view line, int field)
+{
+	if (field == 0)
+	{
+		return line;
+	}
+	auto isBlank = [](char c) { return c == ' ' || c == '\t'; };
+	auto at = std::size_t{0};
+	for (auto i = 1; ; i++)
+	{
+		while (at < line.size() && isBlank(line[at]))
+		{
+			at++;
+		}
+		if (i == field)
+		{
+			return line.substr(at);
+		}
+		while (at < line.size() && not isBlank(line[at]))
+		{
+			at++;
+		}
+	}
+}
+
+// Leading blanks and a plus sign are skipped, as sort -n does.
+std::optional<double> leadingNumber(std::string_view text)
+{
+	text.remove_prefix(std::min(text.find_first_not_of(" \t"), text.size()));
+	if (text.starts_with('+'))
+	{
+		text.remove_prefix(1);
+		if (text.starts_with('-'))
+		{
+			return std::nullopt;
+		}
+	}
+	auto number = 0.0;
+	auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), number);
+	if (error != std::errc{} || std::isnan(number))
+	{
+		return std::nullopt;
+	}
+	return number;
+}
+
+// Options are n for numeric order, r for reverse order (as is !), u to keep
+// only the first of lines with equal keys, and k N to sort on the Nth field
+// rather than the whole line.  Numeric order puts lines that do not start with
+// a number first.  The lines are compared through handles holding their keys,
+// sorted on the thread pool, and put in their new order with a single pass.
+void Editor::sortLines(LineRange range, Force reverse, std::string_view options)
+{
+	auto numeric = false;
+	auto unique = false;
+	auto field = 0;
+	while (not options.empty())
+	{
+		auto option = options.front();
+		options.remove_prefix(1);
+		if (option == 'n')
+		{
+			numeric = true;
+		}
+		else if (option == 'r')
+		{
+			reverse = Force::Yes;
+		}
+		else if (option == 'u')
+		{
+			unique = true;
+		}
+		else if (option == 'k')
+		{
+			options.remove_prefix(std::min(options.find_first_not_of(' '), options.size()));
+			auto [end, error] = std::from_chars(options.data(), options.data() + options.size(), field);
+			if (error != std::errc{} || field < 1)
+			{
+				displayMessage("ERR: k expects a field number");
+				return;
+			}
+			options.remove_prefix(static_cast<std::size_t>(end - options.data()));
+		}
+		else if (option != ' ')
+		{
+			displayMessage("ERR: Unknown sort option " + std::string(1, option));
+			return;
+		}
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	auto count = range.last - range.first + 1;
+	if (not buffer.holdLines(range.first, count))
+	{
+		displayMessage("ERR: Too many lines to hold within the memory limit");
+		return;
+	}
+
+	auto order = std::vector<int>{};
+	auto sortBy = [&](auto makeHandle, auto less)
+	{
+		using Handle = decltype(makeHandle(std::string_view{}, 0));
+		auto handles = std::vector<Handle>(static_cast<std::size_t>(count));
+		buffer.scan(range.first, count, threadPool, [&](int firstLine, std::span<std::string const> lines)
+		{
+			for (auto i = std::size_t{0}; i < lines.size(); i++)
+			{
+				auto index = firstLine - range.first + static_cast<int>(i);
+				handles[static_cast<std::size_t>(index)] = makeHandle(sortKeyOf(lines[i], field), index);
+			}
+		});
+
+		auto compare = [&](Handle const& a, Handle const& b) { return reverse == Force::Yes ? less(b, a) : less(a, b); };
+		parallelSort(threadPool, handles, compare);
+		if (unique)
+		{
+			auto equal = [&](Handle const& a, Handle const& b) { return not compare(a, b) && not compare(b, a); };
+			handles.erase(std::unique(handles.begin(), handles.end(), equal), handles.end());
+		}
+
+		order.reserve(handles.size());
+		for (auto& handle: handles)
+		{
+			order.push_back(handle.line);
+		}
+	};
+
+	if (numeric)
+	{
+		struct NumberHandle
+		{
+			double number;
+			bool hasNumber;
+			int line;
+		};
+		sortBy(
+			[](std::string_view key, int line)
+			{
+				auto number = leadingNumber(key);
+				return NumberHandle{.number=number.value_or(0), .hasNumber=number.has_value(), .line=line};
+			},
+			[](NumberHandle const& a, NumberHandle const& b)
+			{
+				return a.hasNumber != b.hasNumber ? b.hasNumber : a.hasNumber && a.number < b.number;
+			}
+		);
+	}
+	else
+	{
+		struct TextHandle
+		{
+			std::string_view key;
+			int line;
+		};
+		sortBy(
+			[](std::string_view key, int line) { return TextHandle{.key=key, .line=line}; },
+			[](TextHandle const& a, TextHandle const& b) { return a.key < b.key; }
+		);
+	}
+
+	auto removed = count - static_cast<int>(order.size());
+	buffer.rearrangeLines(range.first, count, order);
+	modified = true;
+
+	cursor = {.line=std::min(range.first, std::max(0, buffer.numLines() - 1)), .col=0};
+	adjustViewport();
+	repaintPending = true;
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+	displayMessage(std::to_string(count) + " lines sorted"
+		+ (removed > 0 ? ", " + std::to_string(removed) + " removed" : "")
+		+ " (" + std::to_string(elapsed.count()) + " ms)");
+}
+
+// Removes every line that repeats one above it, wherever it is.  The lines are
+// hashed on the thread pool; then each thread looks for repeats among the
+// lines whose hashes fall to it, so that no two threads ever compare the same
+// line.  The repeats are marked, and deleted with a single pass.
+void Editor::uniqLines(LineRange range)
+{
+	auto start = std::chrono::steady_clock::now();
+	auto count = range.last - range.first + 1;
+	if (not buffer.holdLines(range.first, count))
+	{
+		displayMessage("ERR: Too many lines to hold within the memory limit");
+		return;
+	}
+
+	auto size = static_cast<std::size_t>(count);
+	auto texts = std::vector<std::string_view>(size);
+	auto hashes = std::vector<std::size_t>(size);
+	buffer.scan(range.first, count, threadPool, [&](int firstLine, std::span<std::string const> lines)
+	{
+		auto index = static_cast<std::size_t>(firstLine - range.first);
+		for (auto i = std::size_t{0}; i < lines.size(); i++)
+		{
+			texts[index + i] = lines[i];
+			hashes[index + i] = std::hash<std::string_view>{}(lines[i]);
+		}
+	});
+
+	auto repeats = LineStore::Marks(size);
+	auto removed = std::atomic<int>{0};
+	auto shares = threadPool.size();
+	threadPool.forEach(shares, [&](std::size_t share)
+	{
+		auto hash = [&](std::size_t i) { return hashes[i]; };
+		auto equal = [&](std::size_t a, std::size_t b) { return texts[a] == texts[b]; };
+		auto seen = std::unordered_set<std::size_t, decltype(hash), decltype(equal)>(size / shares + 1, hash, equal);
+		auto found = 0;
+		for (auto i = std::size_t{0}; i < size; i++)
+		{
+			if (hashes[i] % shares == share && not seen.insert(i).second)
+			{
+				repeats[i] = 1;
+				found++;
+			}
+		}
+		removed += found;
+	});
+
+	if (removed == 0)
+	{
+		displayMessage("No repeated lines");
+		return;
+	}
+	buffer.deleteLines(range.first, repeats);
+	modified = true;
+
+	cursor = {.line=std::min(cursor.line, std::max(0, buffer.numLines() - 1)), .col=0};
+	adjustViewport();
+	repaintPending = true;
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+	displayMessage(std::to_string(removed) + " repeated lines removed (" + std::to_string(elapsed.count()) + " ms)");
+}
@@ -0,0 +1,140 @@
+#include "substitution.h"
+
+#include <cassert>
+
+Substitution::Substitution(std::string_view command, std::string const& lastPattern)
+{
+	if (command.empty())
+	{
+		errorMessage = "Substitution expects /pattern/replacement/";
+		return;
+	}
+	auto delimiter = command.front();
+	if (not isPatternDelimiter(delimiter))
+	{
+		errorMessage = "Invalid delimiter";
+		return;
+	}
+	command.remove_prefix(1);
+
+	auto patternText = takeDelimited(command, delimiter);
+	if (patternText.empty())
+	{
+		if (lastPattern.empty())
+		{
+			errorMessage = "No previous pattern";
+			return;
+		}
+		patternText = lastPattern;
+	}
+	replacement = takeDelimited(command, delimiter);
+
+	for (auto flag: command)
+	{
+		if (flag != 'g')
+		{
+			errorMessage = "Unknown flag " + std::string(1, flag);
+			return;
+		}
+		global = true;
+	}
+
+	pattern.emplace(patternText);
+	if (not pattern->isValid())
+	{
+		errorMessage = pattern->error();
+	}
+}
+
+bool Substitution::isValid() const
+{
+	return errorMessage.empty();
+}
+
+std::string const& Substitution::error() const
+{
+	return errorMessage;
+}
+
+std::string const& Substitution::patternText() const
+{
+	assert(pattern);
+	return pattern->text();
+}
+
+std::optional<std::string> Substitution::apply(std::string_view line, int& count) const
+{
+	assert(isValid());
+	auto groups = std::array<Pattern::Match, Pattern::maxGroups>{};
+	auto match = pattern->find(line, 0, groups);
+	if (not match)
+	{
+		return std::nullopt;
+	}
+
+	auto result = std::string{};
+	auto copied = std::size_t{0};
+	auto previousEnd = std::optional<std::size_t>{};
+	while (match)
+	{
+		// An empty match right after another is not one, as in sed.
+		if (match->length > 0 or match->offset != previousEnd)
+		{
+			result.append(line, copied, match->offset - copied);
+			appendReplacement(result, line, *match, groups);
+			count++;
+			copied = match->offset + match->length;
+			previousEnd = copied;
+		}
+		if (not global)
+		{
+			break;
+		}
+
+		// An empty match would be found again in the same place, so the
+		// character after it is kept and the search goes on past it.
+		auto from = match->offset + match->length;
+		if (match->length == 0)
+		{
+			if (from == line.length())
+			{
+				break;
+			}
+			result.append(line, copied, from + 1 - copied);
+			copied = ++from;
+		}
+		match = pattern->find(line, from, groups);
+	}
+	result.append(line, copied);
+	return result;
+}
+
+void Substitution::appendReplacement(std::string& result, std::string_view line, Pattern::Match match,
+	std::array<Pattern::Match, Pattern::maxGroups> const& groups) const
+{
+	for (auto i = std::size_t{0}; i < replacement.length(); i++)
+	{
+		auto c = replacement[i];
+		if (c == '&')
+		{
+			result.append(line, match.offset, match.length);
+		}
+		else if (c == '\\' and i + 1 < replacement.length())
+		{
+			auto escaped = replacement[++i];
+			if (escaped >= '1' and escaped <= '9')
+			{
+				auto& group = groups[static_cast<std::size_t>(escaped - '1')];
+				result.append(line, group.offset, group.length);
+			}
+			else
+			{
+				result += escaped;
+			}
+		}
+		else
+		{
+			result += c;
+		}
+	}
+}
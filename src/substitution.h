@@ -0,0 +1,40 @@
+#ifndef SRC_SUBSTITUTION_H_
+#define SRC_SUBSTITUTION_H_
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "search.h"
+
+// An ex substitution, /pattern/replacement/flags, applied a line at a time.
+// Any other delimiter may stand in for the slashes.  In the replacement & is
+// the matched text and \1 to \9 what the subexpressions matched.  The only
+// flag is g, for every match on a line rather than the first.  Applying it does
+// not change it, but as with Pattern, threads substituting in parallel should
+// each have one of their own.
+class Substitution
+{
+public:
+	// An empty pattern is the last pattern searched for.
+	Substitution(std::string_view command, std::string const& lastPattern);
+
+	bool isValid() const;
+	std::string const& error() const;
+	std::string const& patternText() const;
+
+	// The line with its matches replaced, or nothing if there were none; adds
+	// the number of matches replaced to `count`.
+	std::optional<std::string> apply(std::string_view line, int& count) const;
+
+private:
+	void appendReplacement(std::string& result, std::string_view line, Pattern::Match,
+		std::array<Pattern::Match, Pattern::maxGroups> const& groups) const;
+
+	std::optional<Pattern> pattern{};
+	std::string replacement{};
+	bool global{false};
+	std::string errorMessage{};
+};
+
+#endif // SRC_SUBSTITUTION_H_
@@ -0,0 +1,155 @@
+#include "editor.h"
+
+#include <algorithm>
+#include <cassert>
+
+Editor::SyntaxIndex::SyntaxIndex(Buffer& b)
+	: buffer{b}
+{
+	buffer.attach(this);
+}
+
+Editor::SyntaxIndex::~SyntaxIndex()
+{
+	buffer.detach(this);
+}
+
+void Editor::SyntaxIndex::setSyntax(Syntax newSyntax)
+{
+	syntax = newSyntax;
+	endStates.clear();
+	isDirty = false;
+}
+
+// Lexes a little past `end`, so that a token the edge cuts is still told
+// right.
+std::vector<Token> Editor::SyntaxIndex::tokens(int line, std::size_t end)
+{
+	auto result = std::vector<Token>{};
+	if (syntax == Syntax::None)
+	{
+		return result;
+	}
+	lexUpTo(line);
+	auto text = buffer.getLineText(line);
+	lexLine(syntax, startState(line), LexText{text.head, text.tail}.prefix(end + lookahead), &result);
+	return result;
+}
+
+// Lines changed are dropped from the known states, and lines inserted get
+// placeholders, all marked stale; changes above the known states drop them.
+void Editor::SyntaxIndex::linesChanged(int line, int removed, int inserted)
+{
+	auto known = static_cast<int>(endStates.size());
+	if (line >= base + known)
+	{
+		return;
+	}
+	if (line < base)
+	{
+		endStates.clear();
+		isDirty = false;
+		return;
+	}
+
+	auto first = line - base;
+	auto last = std::min(first + removed, known);
+	endStates.erase(endStates.begin() + first, endStates.begin() + last);
+	endStates.insert(endStates.begin() + first, static_cast<std::size_t>(inserted), initialLexState);
+
+	auto shift = [&](int i) { return i >= first + removed ? i - removed + inserted : std::min(i, first + inserted); };
+	dirtyTo = isDirty ? std::max(shift(dirtyTo), first + inserted) : first + inserted;
+	dirtyFrom = isDirty ? std::min(shift(dirtyFrom), first) : first;
+	isDirty = true;
+}
+
+// The states of the deleted lines are dropped in one pass.  Every line from
+// the first deleted to the one after the last is lexed again, as each run
+// deleted leaves a line with a new line above it.
+void Editor::SyntaxIndex::linesDeleted(int line, std::span<std::uint8_t const> marks)
+{
+	auto known = static_cast<int>(endStates.size());
+	if (line >= base + known)
+	{
+		return;
+	}
+	if (line < base)
+	{
+		endStates.clear();
+		isDirty = false;
+		return;
+	}
+
+	auto first = line - base;
+	auto end = std::min(first + static_cast<int>(marks.size()), known);
+	auto kept = first;
+	for (auto i = first; i < end; i++)
+	{
+		if (marks[static_cast<std::size_t>(i - first)] == 0)
+		{
+			endStates[static_cast<std::size_t>(kept++)] = endStates[static_cast<std::size_t>(i)];
+		}
+	}
+	endStates.erase(endStates.begin() + kept, endStates.begin() + end);
+
+	auto shift = [&](int i)
+	{
+		if (i < first)
+		{
+			return i;
+		}
+		if (i >= end)
+		{
+			return i - (end - kept);
+		}
+		return first + static_cast<int>(std::count(marks.begin(), marks.begin() + (i - first), 0));
+	};
+	dirtyTo = isDirty ? std::max(shift(dirtyTo), kept) : kept;
+	dirtyFrom = isDirty ? std::min(shift(dirtyFrom), first) : first;
+	isDirty = true;
+}
+
+LexState Editor::SyntaxIndex::startState(int line) const
+{
+	assert(line >= base && line <= base + static_cast<int>(endStates.size()));
+	return line == base ? initialLexState : endStates[static_cast<std::size_t>(line - base - 1)];
+}
+
+// Makes the states of the lines above `line` known and up to date.
+void Editor::SyntaxIndex::lexUpTo(int line)
+{
+	auto known = static_cast<int>(endStates.size());
+	if (line < base || line > base + known + maxGap)
+	{
+		base = std::max(0, line - syncLines);
+		endStates.clear();
+		isDirty = false;
+		known = 0;
+	}
+
+	// A line that was not changed and ends in the state it ended in before
+	// leaves every line after it as it was.
+	if (isDirty && dirtyFrom < line - base)
+	{
+		auto i = dirtyFrom;
+		while (isDirty && i < line - base)
+		{
+			auto state = lex(base + i, startState(base + i));
+			auto& endState = endStates[static_cast<std::size_t>(i)];
+			isDirty = not (i >= dirtyTo && state == endState) && i + 1 < known;
+			endState = state;
+			dirtyFrom = ++i;
+		}
+	}
+
+	for (auto i = base + known; i < line; i++)
+	{
+		endStates.push_back(lex(i, startState(i)));
+	}
+}
+
+LexState Editor::SyntaxIndex::lex(int line, LexState state) const
+{
+	auto text = buffer.getLineText(line);
+	return lexLine(syntax, state, {text.head, text.tail}, nullptr);
+}
@@ -0,0 +1,53 @@
+#include "terminal.h"
+
+#include <cstdio>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <curses.h>
+
+int const terminal::pasteStart = KEY_MAX + 1;
+int const terminal::pasteEnd = KEY_MAX + 2;
+int const terminal::noKey = ERR;
+int const terminal::resizeKey = KEY_RESIZE;
+
+void terminal::enableHardwareScrolling()
+{
+	idlok(stdscr, true);
+}
+
+void terminal::enableBracketedPaste()
+{
+	define_key("\033[200~", pasteStart);
+	define_key("\033[201~", pasteEnd);
+	std::fputs("\033[?2004h", stdout);
+	std::fflush(stdout);
+}
+
+void terminal::disableBracketedPaste()
+{
+	std::fputs("\033[?2004l", stdout);
+	std::fflush(stdout);
+}
+
+void terminal::enableNonBlockingInput()
+{
+	keypad(stdscr, true);
+	nodelay(stdscr, true);
+}
+
+void terminal::waitForInput(int otherFd, int timeoutMs)
+{
+	pollfd fds[] = {
+		{.fd=STDIN_FILENO, .events=POLLIN, .revents=0},
+		{.fd=otherFd, .events=POLLIN, .revents=0},
+	};
+	poll(fds, 2, timeoutMs);
+}
+
+bool terminal::hasPendingInput()
+{
+	auto stdinFd = pollfd{.fd=STDIN_FILENO, .events=POLLIN, .revents=0};
+	return poll(&stdinFd, 1, 0) > 0;
+}
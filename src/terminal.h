@@ -0,0 +1,36 @@
+#ifndef SRC_TERMINAL_H_
+#define SRC_TERMINAL_H_
+
+// Terminal control that the ncursespp wrappers don't provide.  Lives in its
+// own translation unit because the <curses.h> macros clash with the wrappers'
+// method names.
+namespace terminal
+{
+	// Lets curses use the terminal's scrolling region and line insert/delete.
+	// When a refresh finds rows of the screen moved, as they are when the view
+	// scrolls, it shifts them on the terminal and draws only the exposed rows.
+	void enableHardwareScrolling();
+
+	// With bracketed paste on, pasted text arrives between these two keys.
+	extern int const pasteStart;
+	extern int const pasteEnd;
+	void enableBracketedPaste();
+	void disableBracketedPaste();
+
+	// What getch returns once curses has noticed the terminal was resized.
+	extern int const resizeKey;
+
+	// Makes getch return noKey instead of waiting when no input has arrived.
+	extern int const noKey;
+	void enableNonBlockingInput();
+
+	// Blocks until there is input to read or otherFd is readable, or for at
+	// most timeoutMs if that is not negative, without touching curses.  A
+	// negative otherFd is ignored.
+	void waitForInput(int otherFd = -1, int timeoutMs = -1);
+
+	// Whether more input is waiting to be read right now.
+	bool hasPendingInput();
+}
+
+#endif // SRC_TERMINAL_H_
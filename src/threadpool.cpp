@@ -0,0 +1,89 @@
+#include "threadpool.h"
+
+#include <algorithm>
+#include <csignal>
+
+#include <pthread.h>
+
+// The workers are started with every signal blocked, so that signals meant
+// for the editor, such as SIGWINCH, reach the input thread.
+ThreadPool::ThreadPool()
+{
+	auto allSignals = sigset_t{};
+	auto previous = sigset_t{};
+	sigfillset(&allSignals);
+	pthread_sigmask(SIG_BLOCK, &allSignals, &previous);
+
+	auto threads = std::max(std::thread::hardware_concurrency(), 1u);
+	for (auto i = 1u; i < threads; i++)
+	{
+		workers.emplace_back([this](std::stop_token stopToken) { run(stopToken); });
+	}
+
+	pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+}
+
+ThreadPool::~ThreadPool()
+{
+	for (auto& worker: workers)
+	{
+		worker.request_stop();
+	}
+	wake.notify_all();
+}
+
+std::size_t ThreadPool::size() const
+{
+	return workers.size() + 1;
+}
+
+void ThreadPool::forEach(std::size_t count, std::function<void(std::size_t)> const& work)
+{
+	{
+		auto lock = std::lock_guard{mutex};
+		job = &work;
+		jobSize = count;
+		next = 0;
+		busy = workers.size();
+		generation++;
+	}
+	wake.notify_all();
+
+	drain();
+
+	auto lock = std::unique_lock{mutex};
+	done.wait(lock, [this] { return busy == 0; });
+	job = nullptr;
+}
+
+void ThreadPool::drain()
+{
+	for (auto i = next++; i < jobSize; i = next++)
+	{
+		(*job)(i);
+	}
+}
+
+void ThreadPool::run(std::stop_token stopToken)
+{
+	auto seen = std::uint64_t{0};
+	while (true)
+	{
+		{
+			auto lock = std::unique_lock{mutex};
+			if (not wake.wait(lock, stopToken, [&] { return generation != seen; }))
+			{
+				return;
+			}
+			seen = generation;
+		}
+
+		drain();
+
+		auto lock = std::lock_guard{mutex};
+		if (--busy == 0)
+		{
+			done.notify_one();
+		}
+	}
+}
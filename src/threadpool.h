@@ -0,0 +1,85 @@
+#ifndef SRC_THREADPOOL_H_
+#define SRC_THREADPOOL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+// Worker threads, one per core, for spreading a pass over many lines.  The
+// thread asking for the work takes part in it too.
+class ThreadPool
+{
+public:
+	ThreadPool();
+	~ThreadPool();
+	ThreadPool(ThreadPool const&) = delete;
+	ThreadPool& operator=(ThreadPool const&) = delete;
+
+	std::size_t size() const;  // the calling thread included
+
+	// Calls work(i) for every i in [0, count), in no particular order and on
+	// any of the threads, and returns once all calls have returned.
+	void forEach(std::size_t count, std::function<void(std::size_t)> const& work);
+
+private:
+	void run(std::stop_token);
+	void drain();
+
+	std::mutex mutex{};
+	std::condition_variable_any wake{};
+	std::condition_variable done{};
+	std::function<void(std::size_t)> const* job{nullptr};
+	std::size_t jobSize{0};
+	std::atomic<std::size_t> next{0};
+	std::size_t busy{0};
+	std::uint64_t generation{0};
+
+	std::vector<std::jthread> workers{};
+};
+
+// A stable sort: the pool's threads each sort a part, then the parts are
+// merged pairwise, the merges of each round also spread over the threads.
+template <typename T, typename Compare>
+void parallelSort(ThreadPool& pool, std::vector<T>& items, Compare compare)
+{
+	constexpr auto minPartSize = std::size_t{1} << 14;
+	auto parts = std::clamp(items.size() / minPartSize, std::size_t{1}, pool.size());
+	auto bounds = std::vector<std::size_t>(parts + 1);
+	for (auto i = std::size_t{0}; i <= parts; i++)
+	{
+		bounds[i] = items.size() * i / parts;
+	}
+	auto at = [&](std::vector<T>& v, std::size_t part)
+	{
+		return v.begin() + static_cast<std::ptrdiff_t>(bounds[std::min(part, parts)]);
+	};
+
+	pool.forEach(parts, [&](std::size_t part)
+	{
+		std::stable_sort(at(items, part), at(items, part + 1), compare);
+	});
+
+	auto merged = std::vector<T>(parts > 1 ? items.size() : 0);
+	for (auto width = std::size_t{1}; width < parts; width *= 2)
+	{
+		pool.forEach((parts + 2 * width - 1) / (2 * width), [&](std::size_t pair)
+		{
+			auto first = pair * 2 * width;
+			std::merge(
+				at(items, first), at(items, first + width),
+				at(items, first + width), at(items, first + 2 * width),
+				at(merged, first), compare
+			);
+		});
+		items.swap(merged);
+	}
+}
+
+#endif // SRC_THREADPOOL_H_
@@ -0,0 +1,80 @@
+#include "utf8.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include <wchar.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Sixteen bytes at a time where SSE2 is to be had, eight otherwise; either
+// way it only looks at whether any byte has its top bit set.
+bool isAscii(std::string_view text)
+{
+	auto i = std::size_t{0};
+#if defined(__SSE2__)
+	auto highBits = _mm_setzero_si128();
+	for (; i + 16 <= text.length(); i += 16)
+	{
+		highBits = _mm_or_si128(highBits, _mm_loadu_si128(reinterpret_cast<__m128i const*>(text.data() + i)));
+	}
+	if (_mm_movemask_epi8(highBits) != 0)
+	{
+		return false;
+	}
+#endif
+	auto word = std::uint64_t{0};
+	for (; i + 8 <= text.length(); i += 8)
+	{
+		auto next = std::uint64_t{};
+		std::memcpy(&next, text.data() + i, sizeof(next));
+		word |= next;
+	}
+	for (; i < text.length(); i++)
+	{
+		word |= static_cast<unsigned char>(text[i]);
+	}
+	return (word & 0x8080808080808080) == 0;
+}
+
+bool isWellFormed(char32_t codePoint, std::size_t length)
+{
+	static constexpr char32_t shortest[] = {0, 0, 0200, 04000, 0200000};  // below these it fits in fewer bytes
+	return codePoint >= shortest[length] && codePoint <= 0x10FFFF && (codePoint < 0xD800 || codePoint > 0xDFFF);
+}
+
+// The width is what the C library says, as curses asks it too.
+int displayWidth(Utf8Char c)
+{
+	if (c.codePoint == notACharacter)
+	{
+		return 1;
+	}
+	auto width = wcwidth(static_cast<wchar_t>(c.codePoint));
+	return width < 0 ? static_cast<int>(c.length) : width;
+}
+
+bool isShowable(Utf8Char c)
+{
+	return c.codePoint < 0200 || (c.codePoint != notACharacter && wcwidth(static_cast<wchar_t>(c.codePoint)) >= 0);
+}
+
+bool isCombining(Utf8Char c)
+{
+	return c.codePoint >= 0200 && c.codePoint != notACharacter && wcwidth(static_cast<wchar_t>(c.codePoint)) == 0;
+}
+
+void maskUnshowable(std::string& text)
+{
+	for (auto i = std::size_t{0}; i < text.length();)
+	{
+		auto c = decodeUtf8(text, i);
+		if (not isShowable(c))
+		{
+			text.replace(i, c.length, c.length, '?');
+		}
+		i += c.length;
+	}
+}
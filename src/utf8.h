@@ -0,0 +1,130 @@
+#ifndef SRC_UTF8_H_
+#define SRC_UTF8_H_
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Text is taken to be UTF-8.  A byte that is not part of a well-formed
+// sequence is a character of its own, and it and any character the terminal
+// has no way to show are shown as a '?' for each of their bytes.  Most lines
+// are plain ASCII, which isAscii tells cheaply, so that they can be measured a
+// byte at a time without decoding anything.
+
+[[nodiscard]] bool isAscii(std::string_view);
+
+struct Utf8Char
+{
+	char32_t codePoint;
+	std::size_t length;  // in bytes
+};
+
+// What a stray byte decodes to.
+constexpr auto notACharacter = char32_t{0xFFFFFFFF};
+
+[[nodiscard]] bool isWellFormed(char32_t codePoint, std::size_t length);
+
+// The character starting at byte i of anything indexed by bytes, such as a
+// line in two pieces.
+template<typename Text>
+Utf8Char decodeUtf8(Text const& text, std::size_t i)
+{
+	auto lead = static_cast<unsigned char>(text[i]);
+	if (lead < 0200)
+	{
+		return {.codePoint=lead, .length=1};
+	}
+	// 0300 and 0301 could only start a sequence longer than what it holds
+	// needs, and from 0365 on one past the last code point
+	auto length = std::size_t{lead >= 0365 ? 0u : lead >= 0360 ? 4u : lead >= 0340 ? 3u : lead >= 0302 ? 2u : 0u};
+	if (length == 0 || text.length() - i < length)
+	{
+		return {.codePoint=notACharacter, .length=1};
+	}
+	auto codePoint = static_cast<char32_t>(lead & (0177u >> length));
+	for (auto k = std::size_t{1}; k < length; k++)
+	{
+		auto byte = static_cast<unsigned char>(text[i + k]);
+		if ((byte & 0300) != 0200)
+		{
+			return {.codePoint=notACharacter, .length=1};
+		}
+		codePoint = codePoint << 6 | (byte & 077u);
+	}
+	if (not isWellFormed(codePoint, length))
+	{
+		return {.codePoint=notACharacter, .length=1};
+	}
+	return {.codePoint=codePoint, .length=length};
+}
+
+// Screen columns taken by a character other than ASCII: none for combining
+// marks, two for wide East Asian ones.  One that cannot be shown takes as many
+// as it has bytes.
+[[nodiscard]] int displayWidth(Utf8Char);
+[[nodiscard]] bool isShowable(Utf8Char);
+[[nodiscard]] bool isCombining(Utf8Char);
+
+// Puts the '?'s in for what cannot be shown; the text keeps its length.
+void maskUnshowable(std::string&);
+
+// The start of the sequence covering byte i, or i itself for a stray byte.
+template<typename Text>
+std::size_t sequenceStart(Text const& text, std::size_t i)
+{
+	auto start = i;
+	while (start > 0 && i - start < 3 && (static_cast<unsigned char>(text[start]) & 0300) == 0200)
+	{
+		start--;
+	}
+	return decodeUtf8(text, start).length > i - start ? start : i;
+}
+
+// The cursor moves a character at a time, and combining marks belong with the
+// character before them, so it is never left on one.
+
+// Where the character covering byte i starts, or i if it is past the end.
+template<typename Text>
+std::size_t characterStart(Text const& text, std::size_t i)
+{
+	if (i >= text.length())
+	{
+		return i;
+	}
+	i = sequenceStart(text, i);
+	while (i > 0 && isCombining(decodeUtf8(text, i)))
+	{
+		i = sequenceStart(text, i - 1);
+	}
+	return i;
+}
+
+// Where the character after the one at byte i starts, or the end.
+template<typename Text>
+std::size_t nextCharacter(Text const& text, std::size_t i)
+{
+	if (i >= text.length())
+	{
+		return text.length();
+	}
+	i += decodeUtf8(text, i).length;
+	while (i < text.length())
+	{
+		auto c = decodeUtf8(text, i);
+		if (not isCombining(c))
+		{
+			break;
+		}
+		i += c.length;
+	}
+	return i;
+}
+
+// Where the character before byte i starts, or 0.
+template<typename Text>
+std::size_t previousCharacter(Text const& text, std::size_t i)
+{
+	return i == 0 ? 0 : characterStart(text, i - 1);
+}
+
+#endif // SRC_UTF8_H_
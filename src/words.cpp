@@ -0,0 +1,166 @@
+#include "words.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+constexpr auto blockSize = std::size_t{64};
+
+// Bit k stands for byte k of a block.
+struct ClassMasks
+{
+	std::uint64_t word;
+	std::uint64_t punctuation;
+};
+
+// Bit 0 of each mask for a single byte.
+ClassMasks classifyByte(char c)
+{
+	auto byte = static_cast<unsigned char>(c);
+	auto lower = byte | 040u;
+	if ((lower >= 'a' && lower <= 'z') || (byte >= '0' && byte <= '9') || byte == '_' || byte >= 0200)
+	{
+		return {.word=1, .punctuation=0};
+	}
+	if (byte == ' ' || (byte >= '\t' && byte <= '\r'))
+	{
+		return {.word=0, .punctuation=0};
+	}
+	return {.word=0, .punctuation=1};
+}
+
+#if defined(__SSE2__)
+ClassMasks classifyBytes(char const* bytes)
+{
+	auto word = std::uint64_t{0};
+	auto blank = std::uint64_t{0};
+	for (auto lane = 0; lane < 4; lane++)
+	{
+		auto x = _mm_loadu_si128(reinterpret_cast<__m128i const*>(bytes + 16 * lane));
+		auto inRange = [](__m128i v, char low, char high)
+		{
+			return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(static_cast<char>(low - 1))),
+				_mm_cmplt_epi8(v, _mm_set1_epi8(static_cast<char>(high + 1))));
+		};
+		auto isBlank = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), inRange(x, '\t', '\r'));
+		// bytes beyond ASCII are negative
+		auto isWord = _mm_or_si128(
+			_mm_or_si128(inRange(_mm_or_si128(x, _mm_set1_epi8(040)), 'a', 'z'), inRange(x, '0', '9')),
+			_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('_')), _mm_cmplt_epi8(x, _mm_setzero_si128())));
+		word |= std::uint64_t{static_cast<std::uint16_t>(_mm_movemask_epi8(isWord))} << (16 * lane);
+		blank |= std::uint64_t{static_cast<std::uint16_t>(_mm_movemask_epi8(isBlank))} << (16 * lane);
+	}
+	return {.word=word, .punctuation=~(word | blank)};
+}
+#else
+ClassMasks classifyBytes(char const* bytes)
+{
+	auto masks = ClassMasks{.word=0, .punctuation=0};
+	for (auto k = std::size_t{0}; k < blockSize; k++)
+	{
+		auto [word, punctuation] = classifyByte(bytes[k]);
+		masks.word |= word << k;
+		masks.punctuation |= punctuation << k;
+	}
+	return masks;
+}
+#endif
+
+ClassMasks forKind(ClassMasks masks, WordKind kind)
+{
+	if (kind == WordKind::BigWord)
+	{
+		return {.word=masks.word | masks.punctuation, .punctuation=0};
+	}
+	return masks;
+}
+
+// The block of the line starting at byte `base`, what is past its end taken to
+// be blank.
+ClassMasks classifyBlock(std::string_view line, std::size_t base, WordKind kind)
+{
+	if (line.length() - base >= blockSize)
+	{
+		return forKind(classifyBytes(line.data() + base), kind);
+	}
+	auto padded = std::array<char, blockSize>{};
+	padded.fill(' ');
+	std::copy(line.begin() + static_cast<std::ptrdiff_t>(base), line.end(), padded.begin());
+	return forKind(classifyBytes(padded.data()), kind);
+}
+
+// The byte just before or after a block, which may be past the end.
+ClassMasks classifyNeighbour(std::string_view line, std::size_t i, WordKind kind)
+{
+	return i < line.length() ? forKind(classifyByte(line[i]), kind) : ClassMasks{.word=0, .punctuation=0};
+}
+
+// Where a class begins that the byte before did not have.
+std::uint64_t wordStarts(std::string_view line, std::size_t base, WordKind kind)
+{
+	auto masks = classifyBlock(line, base, kind);
+	auto before = base == 0 ? ClassMasks{.word=0, .punctuation=0} : classifyNeighbour(line, base - 1, kind);
+	return (masks.word & ~(masks.word << 1 | before.word))
+		| (masks.punctuation & ~(masks.punctuation << 1 | before.punctuation));
+}
+
+// Where a class ends that the byte after does not have.
+std::uint64_t wordEnds(std::string_view line, std::size_t base, WordKind kind)
+{
+	auto masks = classifyBlock(line, base, kind);
+	auto after = classifyNeighbour(line, base + blockSize, kind);
+	return (masks.word & ~(masks.word >> 1 | after.word << 63))
+		| (masks.punctuation & ~(masks.punctuation >> 1 | after.punctuation << 63));
+}
+
+std::uint64_t bitsFrom(std::size_t bit)
+{
+	return bit >= blockSize ? 0 : ~std::uint64_t{0} << bit;
+}
+
+std::optional<std::size_t> findWordStart(std::string_view line, std::size_t from, WordKind kind)
+{
+	for (auto base = from / blockSize * blockSize; base < line.length(); base += blockSize)
+	{
+		auto starts = wordStarts(line, base, kind) & bitsFrom(std::max(from, base) - base);
+		if (starts != 0)
+		{
+			return base + static_cast<std::size_t>(std::countr_zero(starts));
+		}
+	}
+	return std::nullopt;
+}
+
+std::optional<std::size_t> findWordStartBefore(std::string_view line, std::size_t before, WordKind kind)
+{
+	before = std::min(before, line.length());
+	for (auto end = before; end > 0;)
+	{
+		auto base = (end - 1) / blockSize * blockSize;
+		auto starts = wordStarts(line, base, kind) & ~bitsFrom(end - base);
+		if (starts != 0)
+		{
+			return base + blockSize - 1 - static_cast<std::size_t>(std::countl_zero(starts));
+		}
+		end = base;
+	}
+	return std::nullopt;
+}
+
+std::optional<std::size_t> findWordEnd(std::string_view line, std::size_t from, WordKind kind)
+{
+	for (auto base = from / blockSize * blockSize; base < line.length(); base += blockSize)
+	{
+		auto ends = wordEnds(line, base, kind) & bitsFrom(std::max(from, base) - base);
+		if (ends != 0)
+		{
+			return base + static_cast<std::size_t>(std::countr_zero(ends));
+		}
+	}
+	return std::nullopt;
+}
@@ -0,0 +1,28 @@
+#ifndef SRC_WORDS_H_
+#define SRC_WORDS_H_
+
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+// Word motions look at a line 64 bytes at a time, sorting the bytes into
+// blanks, word characters (letters, digits, underscore and everything beyond
+// ASCII, so that words in other scripts hold together) and punctuation, a
+// bit for each byte, and find where words start and end from where the
+// classes change.  A word is a run of word characters or one of punctuation;
+// a big word is a run of anything but blanks.  The ends of a line count as
+// blanks.
+
+enum class WordKind
+{
+	Word, BigWord
+};
+
+// The first byte at or after `from` that starts a word, if any.
+std::optional<std::size_t> findWordStart(std::string_view line, std::size_t from, WordKind);
+// The last start of a word before `before`, if any.
+std::optional<std::size_t> findWordStartBefore(std::string_view line, std::size_t before, WordKind);
+// The first byte at or after `from` that ends a word, if any.
+std::optional<std::size_t> findWordEnd(std::string_view line, std::size_t from, WordKind);
+
+#endif // SRC_WORDS_H_
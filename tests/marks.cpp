@@ -0,0 +1,81 @@
+// Marks across :g/pattern/d, which deletes every matching line in one go: a
+// mark on a line that goes goes with it, and every other mark stays on the
+// line it was set on.
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "editor.h"
+
+int failures = 0;
+
+void expect(bool condition, std::string const& what)
+{
+	if (not condition)
+	{
+		std::fprintf(stderr, "FAIL: %s\n", what.c_str());
+		failures++;
+	}
+}
+
+// Marks every line, deletes the lines matching the pattern the way :g does,
+// and checks each mark against the text of the line it names.
+void checkGlobalDelete(std::vector<std::string> const& text, std::string const& pattern)
+{
+	auto buffer = Editor::Buffer{};
+	auto marks = Editor::MarkIndex{buffer};
+	buffer.insertLines(0, text);
+	for (auto i = 0; i < buffer.numLines(); i++)
+	{
+		marks.set(i, i);
+	}
+
+	auto matcher = Pattern{pattern};
+	auto matching = LineStore::Marks(text.size());
+	for (auto i = std::size_t{0}; i < text.size(); i++)
+	{
+		matching[i] = matcher.matches(text[i]) ? 1 : 0;
+	}
+	buffer.deleteLines(0, matching);
+
+	auto left = 0;
+	for (auto i = std::size_t{0}; i < text.size(); i++)
+	{
+		auto id = static_cast<int>(i);
+		auto line = marks.line(id);
+		auto what = ":g/" + pattern + "/d, mark on `" + text[i] + "'";
+		if (matching[i] != 0)
+		{
+			expect(not line.has_value(), what + " is gone");
+			continue;
+		}
+		expect(line == left, what + " is on line " + std::to_string(left));
+		expect(line.has_value() && *line < buffer.numLines() && buffer.getLine(*line) == text[i],
+			what + " is on its line");
+		left++;
+	}
+	expect(buffer.numLines() == left, ":g/" + pattern + "/d leaves " + std::to_string(left) + " lines");
+}
+
+int main()
+{
+	auto text = std::vector<std::string>{};
+	for (auto i = 0; i < 40; i++)
+	{
+		// runs of one, two and three deleted lines, at the start and the end
+		auto drop = i % 7 == 0 || i % 7 == 3 || i % 7 == 4 || i >= 37;
+		text.push_back(std::to_string(i) + (drop ? " drop" : " keep"));
+	}
+	checkGlobalDelete(text, "drop");
+	checkGlobalDelete(text, "keep");
+	checkGlobalDelete(text, "^1");
+	checkGlobalDelete({"a", "b", "a", "a", "b"}, "a");
+
+	if (failures > 0)
+	{
+		std::fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	return 0;
+}